@@ -28,6 +28,14 @@ enum Option
 	N_Threads,
 	Help,
 	NoPOR,
+	HugePages,
+	Symmetry,
+	Counters,
+	Workers,
+	Seed,
+	Processes,
+	SleepSets,
+	Ample,
 	Unknown
 };
 
@@ -62,6 +70,14 @@ const option::Descriptor usage[] =
 	{ Option::InlOutput, 0,  "", "inliner-output", Arg::Required, "  --inliner-output   Where to write inlined nts (mainly for debug purposes)" },
 	{ Option::N_Threads, 0,  "",        "threads", Arg::Numeric,  "  --threads          Number of threads in thread pool" },
 	{ Option::NoPOR,     0,  "",         "no-por", Arg::None,     "  --no-por           Do not use Partial Order reduction " },
+	{ Option::HugePages, 0,  "",     "huge-pages", Arg::None,     "  --huge-pages       Allocate explored states on huge pages" },
+	{ Option::Symmetry,  0,  "",       "symmetry", Arg::None,     "  --symmetry         Merge states differing only by permutation of threads, which do not read tid" },
+	{ Option::Counters,  0,  "",       "counters", Arg::Numeric,  "  --counters=N       With --symmetry, store instances of N or more threads as counters" },
+	{ Option::Workers,   0,  "",        "workers", Arg::Numeric,  "  --workers=N        Explore state space using N threads" },
+	{ Option::Seed,      0,  "",           "seed", Arg::Numeric,  "  --seed=N           Seed of work stealing" },
+	{ Option::Processes, 0,  "",      "processes", Arg::Numeric,  "  --processes=N      Explore state space using N local processes" },
+	{ Option::SleepSets, 0,  "",     "sleep-sets", Arg::None,     "  --sleep-sets       Do not explore transitions commuting with already explored ones" },
+	{ Option::Ample,     0,  "",          "ample", Arg::Required, "  --ample=S          Choice of ample set: first, fewest, local, main-last or cheapest" },
 	{ Option::Help,      0, "h",           "help", Arg::None,     "  --help             Print usage and exit." },
 	{ Option::Unknown,   0,  "",               "", Arg::None,     "\nExample: run -o seq.nts parallel.ll" },
 
@@ -100,6 +116,53 @@ int main ( int argc, char **argv )
 	if ( options[NoPOR ] )
 		mode = SeqMode::Simple;
 
+	SeqOptions seq_opts;
+	if ( options[HugePages] )
+		seq_opts.huge_pages = true;
+	if ( options[Symmetry] )
+		seq_opts.symmetry = true;
+	if ( options[Counters] )
+	{
+		std::stringstream ss ( options[Counters].arg );
+		ss >> seq_opts.counters;
+	}
+	if ( options[Workers] )
+	{
+		std::stringstream ss ( options[Workers].arg );
+		ss >> seq_opts.workers;
+	}
+	if ( options[Seed] )
+	{
+		std::stringstream ss ( options[Seed].arg );
+		ss >> seq_opts.seed;
+	}
+	if ( options[Processes] )
+	{
+		std::stringstream ss ( options[Processes].arg );
+		ss >> seq_opts.processes;
+	}
+	if ( options[SleepSets] )
+		seq_opts.sleep_sets = true;
+	if ( options[Ample] )
+	{
+		const string s = options[Ample].arg;
+		if ( s == "first" )
+			seq_opts.ample = AmpleStrategy::First;
+		else if ( s == "fewest" )
+			seq_opts.ample = AmpleStrategy::Fewest;
+		else if ( s == "local" )
+			seq_opts.ample = AmpleStrategy::Local;
+		else if ( s == "main-last" )
+			seq_opts.ample = AmpleStrategy::MainLast;
+		else if ( s == "cheapest" )
+			seq_opts.ample = AmpleStrategy::Cheapest;
+		else
+		{
+			cerr << "Unknown ample strategy '" << s << "'\n";
+			return 1;
+		}
+	}
+
 
 	if ( parse.nonOptionsCount() != 1 )
 	{
@@ -135,7 +198,8 @@ int main ( int argc, char **argv )
 
 	unique_ptr < Nts > result = sequentialize (
 			* nts,
-			mode
+			mode,
+			seq_opts
 			);
 
 	if ( ! result )
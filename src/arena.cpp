@@ -0,0 +1,97 @@
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "arena.hpp"
+
+using std::size_t;
+using std::uintptr_t;
+
+namespace nts {
+namespace seq {
+
+Arena::Arena ( bool huge_pages ) :
+	_huge_pages ( huge_pages )
+{
+	_cur = nullptr;
+	_left = 0;
+	_reserved = 0;
+}
+
+Arena::~Arena()
+{
+	clear();
+}
+
+Arena::Chunk Arena::map_chunk ( size_t size )
+{
+	const int prot  = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void * mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	// Explicit huge pages are available only if the administrator reserved some
+	if ( _huge_pages && size % chunk_size == 0 )
+		mem = mmap ( nullptr, size, prot, flags | MAP_HUGETLB, -1, 0 );
+#endif
+
+	if ( mem == MAP_FAILED )
+	{
+		mem = mmap ( nullptr, size, prot, flags, -1, 0 );
+		if ( mem == MAP_FAILED )
+			throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+		if ( _huge_pages )
+			madvise ( mem, size, MADV_HUGEPAGE );
+#endif
+	}
+
+	_reserved += size;
+	return Chunk { mem, size };
+}
+
+void Arena::unmap_chunk ( const Chunk & c )
+{
+	munmap ( c.mem, c.size );
+	_reserved -= c.size;
+}
+
+void * Arena::allocate ( size_t bytes, size_t align )
+{
+	uintptr_t p = reinterpret_cast < uintptr_t > ( _cur );
+	size_t pad = ( align - p % align ) % align;
+
+	if ( !_cur || pad + bytes > _left )
+	{
+		// Big objects get their own chunk
+		size_t size = chunk_size;
+		while ( size < bytes )
+			size *= 2;
+
+		Chunk c = map_chunk ( size );
+		_chunks.push_back ( c );
+		_cur  = static_cast < unsigned char * > ( c.mem );
+		_left = c.size;
+		pad   = 0; // chunks are page aligned
+	}
+
+	unsigned char * result = _cur + pad;
+	_cur  += pad + bytes;
+	_left -= pad + bytes;
+	return result;
+}
+
+void Arena::clear()
+{
+	for ( const Chunk & c : _chunks )
+		unmap_chunk ( c );
+
+	_chunks.clear();
+	_cur = nullptr;
+	_left = 0;
+}
+
+} // namespace seq
+} // namespace nts
@@ -0,0 +1,71 @@
+#ifndef POR_SRC_ARENA_HPP_
+#define POR_SRC_ARENA_HPP_
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace nts {
+namespace seq {
+
+/**
+ * @brief Bump allocator owning a list of big memory chunks.
+ *
+ * Objects allocated from an arena are never destroyed one by one.
+ * All memory is released at once, when the arena is destroyed,
+ * so only trivially destructible objects should be placed here.
+ *
+ * Chunks are mapped directly from the system. If huge pages are requested,
+ * explicit huge pages are tried first and transparent huge pages
+ * are used as a fallback.
+ */
+class Arena
+{
+	private:
+		struct Chunk
+		{
+			void * mem;
+			std::size_t size;
+		};
+
+		const bool _huge_pages;
+
+		std::vector < Chunk > _chunks;
+		unsigned char * _cur;
+		std::size_t _left;
+		std::size_t _reserved;
+
+		Chunk map_chunk ( std::size_t size );
+		void  unmap_chunk ( const Chunk & c );
+
+	public:
+		static const std::size_t chunk_size = 2 * 1024 * 1024;
+
+		explicit Arena ( bool huge_pages = false );
+		~Arena();
+
+		Arena ( const Arena & ) = delete;
+		Arena & operator= ( const Arena & ) = delete;
+
+		void * allocate ( std::size_t bytes, std::size_t align = alignof ( std::max_align_t ) );
+
+		template < typename T, typename ... Args >
+		T * create ( Args && ... args )
+		{
+			void * mem = allocate ( sizeof ( T ), alignof ( T ) );
+			return new ( mem ) T ( std::forward < Args > ( args ) ... );
+		}
+
+		// Releases all chunks at once
+		void clear();
+
+		// Number of bytes obtained from the system
+		std::size_t reserved_bytes() const { return _reserved; }
+};
+
+} // namespace seq
+} // namespace nts
+
+#endif // POR_SRC_ARENA_HPP_
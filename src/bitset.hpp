@@ -0,0 +1,138 @@
+#ifndef POR_SRC_BITSET_HPP_
+#define POR_SRC_BITSET_HPP_
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nts {
+namespace seq {
+
+/**
+ * @brief Dense set of small integers.
+ *
+ * Size is chosen at runtime, but all sets combined together
+ * are expected to have the same size, so that binary operations
+ * are just loops over words.
+ *
+ * invariant: I1: bits with index >= size() are zero
+ */
+class BitSet
+{
+	public:
+		using word_t = std::uint64_t;
+		static const unsigned int word_bits = 64;
+
+	private:
+		std::vector < word_t > _words;
+		std::size_t _size;
+
+	public:
+		BitSet() : _size ( 0 ) { ; }
+		explicit BitSet ( std::size_t size ) :
+			_words ( ( size + word_bits - 1 ) / word_bits, 0 ),
+			_size ( size )
+		{
+			;
+		}
+
+		std::size_t size() const { return _size; }
+
+		void resize ( std::size_t size )
+		{
+			_words.resize ( ( size + word_bits - 1 ) / word_bits, 0 );
+			_size = size;
+		}
+
+		void set ( std::size_t i )
+		{
+			_words [ i / word_bits ] |= word_t ( 1 ) << ( i % word_bits );
+		}
+
+		void reset ( std::size_t i )
+		{
+			_words [ i / word_bits ] &= ~ ( word_t ( 1 ) << ( i % word_bits ) );
+		}
+
+		bool test ( std::size_t i ) const
+		{
+			return ( _words [ i / word_bits ] >> ( i % word_bits ) ) & 1;
+		}
+
+		void clear()
+		{
+			for ( word_t & w : _words )
+				w = 0;
+		}
+
+		bool any() const
+		{
+			for ( word_t w : _words )
+			{
+				if ( w )
+					return true;
+			}
+			return false;
+		}
+
+		/**
+		 * @pre other.size() <= size()
+		 */
+		void union_with ( const BitSet & other )
+		{
+			for ( std::size_t i = 0; i < other._words.size(); i++ )
+				_words[i] |= other._words[i];
+		}
+
+		// Removes all items of 'other'
+		void subtract ( const BitSet & other )
+		{
+			const std::size_t n = _words.size() < other._words.size()
+				? _words.size() : other._words.size();
+
+			for ( std::size_t i = 0; i < n; i++ )
+				_words[i] &= ~other._words[i];
+		}
+
+		bool intersects ( const BitSet & other ) const
+		{
+			const std::size_t n = _words.size() < other._words.size()
+				? _words.size() : other._words.size();
+
+			for ( std::size_t i = 0; i < n; i++ )
+			{
+				if ( _words[i] & other._words[i] )
+					return true;
+			}
+			return false;
+		}
+
+		bool operator== ( const BitSet & other ) const
+		{
+			return _size == other._size && _words == other._words;
+		}
+
+		bool operator!= ( const BitSet & other ) const { return ! ( *this == other ); }
+
+		// Calls f ( i ) for every i in the set, in increasing order
+		template < typename F >
+		void for_each ( F f ) const
+		{
+			for ( std::size_t w = 0; w < _words.size(); w++ )
+			{
+				word_t bits = _words[w];
+				while ( bits )
+				{
+					unsigned int b = __builtin_ctzll ( bits );
+					f ( w * word_bits + b );
+					bits &= bits - 1;
+				}
+			}
+		}
+};
+
+} // namespace seq
+} // namespace nts
+
+#endif // POR_SRC_BITSET_HPP_
@@ -1,8 +1,13 @@
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <stdexcept>
 #include <regex>
+#include <tuple>
 #include <utility>
 
 #include <libNTS/nts.hpp>
@@ -11,10 +16,13 @@
 
 #include "tasks.hpp"
 #include "control_flow_graph.hpp"
+#include "distributed_explorer.hpp"
+#include "parallel_explorer.hpp"
 
 using std::hash;
 using std::regex;
 using std::logic_error;
+using std::memcpy;
 using std::ostream;
 using std::cout;
 using std::size_t;
@@ -30,112 +38,39 @@ using namespace nts::sugar;
 namespace nts {
 namespace seq {
 
-//------------------------------------//
-// ProcessState                       //
-//------------------------------------//
-
-bool ProcessState::operator== ( const ProcessState & other ) const
-{
-	if ( bnts_state != other.bnts_state )
-		return false;
-
-	return true;
-}
-
-bool ProcessState::operator!= ( const ProcessState & other ) const
-{
-	return ( ! ( *this == other ) );
-}
-
-// from http://stackoverflow.com/a/21062236
-template<typename Tval>
-struct MyTemplatePointerHash1 {
-	    size_t operator()(const Tval* val) const
-		{
-			static const size_t shift = (size_t)log2(1 + sizeof(Tval));
-			return (size_t)(val) >> shift;
-		}
-};
-
-size_t ProcessState::calculate_hash ( const ProcessState & st )
-{
-	MyTemplatePointerHash1<State> h;
-	return h ( st.bnts_state );
-}
-
 //------------------------------------//
 // ControlState                       //
 //------------------------------------//
 
-bool ControlState::operator== ( const ControlState & other ) const
-{
-	if ( states.size() != other.states.size() )
-		return false;
-
-	for ( unsigned int i = 0; i < states.size(); i++ )
-	{
-		if ( states[i] != other.states[i] )
-			return false;
-	}
-
-	return true;
-}
-
-void ControlState::print ( ostream & o ) const
+void ControlState::print ( ostream & o, const ProcessVectorLayout & l ) const
 {
 	o << "( ";
-	if ( states.empty() )
+	if ( l.n_processes() == 0 )
 	{
 		o << ")";
 		return;
 	}
 
-	for ( unsigned int i = 0; i < states.size() - 1; i++ )
-	{
-		o << states[i].bnts_state->name << " | ";
-	}
-
-	o << states.back().bnts_state->name << " )";
-}
-
-// from http://stackoverflow.com/a/2595226
-template <class T>
-inline void hash_combine(std::size_t& seed, const T& v)
-{
-	    std::hash<T> hasher;
-		    seed ^= hasher(v) + 0x9e3779b9 + (seed<<6) + (seed>>2);
-}
-
-size_t ControlState::calculate_hash ( const ControlState & cs )
-{
-	size_t h = 0;
-	for ( const ProcessState & p : cs.states )
+	for ( unsigned int i = 0; i < l.n_processes() - 1; i++ )
 	{
-		hash_combine ( h, ProcessState::calculate_hash ( p ) );
+		o << l.state ( processes(), i )->name << " | ";
 	}
-	return h;
-}
 
-size_t ControlState::calculate_hash_p ( const ControlState * cs )
-{
-	return calculate_hash ( *cs );
+	o << l.state ( processes(), l.n_processes() - 1 )->name << " )";
 }
 
-void ControlState::create_nts_state ( string name )
+State * ControlState::create_nts_state ( string name, const ProcessVectorLayout & l ) const
 {
-	if ( nts_state )
-		throw std::logic_error ( "Already have nts state" );
-
-	nts_state = new State ( move ( name ) );
+	State * nts_state = new State ( move ( name ) );
 	// Add some annotations
 
 	std::stringstream ss;
 	ss << "( ";
-	unsigned int count = states.size();
-	for ( const ProcessState & ps : states )
+	unsigned int count = l.n_processes();
+	for ( unsigned int i = 0; i < l.n_processes(); i++ )
 	{
 		--count;
-		AnnotString * as = find_annot_origin ( ps.bnts_state->annotations );
+		AnnotString * as = find_annot_origin ( l.state ( processes(), i )->annotations );
 		if ( ! as )
 			ss << "-";
 		else
@@ -149,157 +84,464 @@ void ControlState::create_nts_state ( string name )
 
 	AnnotString * as = new AnnotString ( "origin", ss.str());
 	as->insert_to ( nts_state->annotations );
+	return nts_state;
 }
 
-ControlState * initial_control_state ( const Nts & n )
+//------------------------------------//
+// ControlFlowGraph                   //
+//------------------------------------//
+
+
+ControlFlowGraph::ControlFlowGraph ( const Nts & orig_nts, const SeqOptions & opts ) :
+	original_nts ( orig_nts ),
+	_layout ( orig_nts, opts.symmetry, opts.counters ),
+	_state_arena ( opts.huge_pages ),
+	_edge_arena ( opts.huge_pages ),
+	states ( _layout )
 {
-	ControlState * cs = new ControlState();
+	initial = nullptr;
+	_n_edges = 0;
+	_is_frozen = false;
+	_edge_visitor = nullptr;
 
-	for ( const Instance * i : n.instances() )
-	{
-		const BasicNts & bn = i->basic_nts();
-		State * initial_state = nullptr;
+	if ( opts.processes > 0 )
+		_distributed.reset ( new DistributedExplorer ( *this, opts ) );
+	else if ( opts.workers > 1 )
+		_explorer.reset ( new ParallelExplorer ( *this, opts ) );
+
+	_sleep_sets = opts.sleep_sets && !parallel() && !_layout.symmetric()
+		&& _layout.n_processes() <= 64;
 
-		for ( State * s : bn.states() )
+	if ( opts.symmetry )
+	{
+		cout << "Symmetric blocks:";
+		for ( const ProcessVectorLayout::Block & b : _layout.blocks() )
 		{
-			if ( s->is_initial() )
-			{
-				if ( initial_state )
-					throw logic_error ( "Only one initial state is supported" );
-				initial_state = s;
-			}
+			if ( b.symmetric )
+				cout << " " << b.bnts->name << " (" << b.size
+					 << ( b.counted ? ", counted)" : ")" );
 		}
+		if ( !_layout.symmetric() )
+			cout << " none";
+		cout << "\n";
 
-		for ( unsigned int j = 0; j < i->n; j++ )
-			cs->states.push_back ( ProcessState ( initial_state ) );
+		// Blocks of more threads are not symmetric only if they read 'tid'
+		bool reads_tid = false;
+		for ( const ProcessVectorLayout::Block & b : _layout.blocks() )
+		{
+			if ( b.symmetric || b.size < 2 )
+				continue;
 
+			if ( !reads_tid )
+				cout << "Not symmetric, threads read 'tid':";
+			reads_tid = true;
+			cout << " " << b.bnts->name << " (" << b.size << ")";
+		}
+		if ( reads_tid )
+			cout << "\n";
 	}
 
-	return cs;
+	if ( opts.sleep_sets && !_sleep_sets )
+		cout << "Sleep sets are used only by sequential search without symmetry"
+			 << " of at most 64 processes\n";
 }
 
-//------------------------------------//
-// ControlState::DFSInfo              //
-//------------------------------------//
-
-ControlState::DFSInfo::DFSInfo()
+ControlFlowGraph::~ControlFlowGraph()
 {
-	this->st= St::New;
-	this->reached_from = nullptr;
-	this->visited_next = 0;
+	// States and edges are released together with arenas
 }
 
-//------------------------------------//
-// ControlFlowGraph                   //
-//------------------------------------//
-
+ControlState * ControlFlowGraph::initial_control_state()
+{
+	void * mem = _state_arena.allocate (
+			sizeof ( ControlState ) + _layout.stride(), alignof ( ControlState ) );
+	ControlState * cs = new ( mem ) ControlState ( 0, states.size() );
+	_layout.initial ( original_nts, cs->processes() );
+	cs->hash = _layout.hash ( cs->processes() );
+	return cs;
+}
 
-ControlFlowGraph::ControlFlowGraph ( const Nts & orig_nts ) :
-	original_nts ( orig_nts ),
-	states (1000, ControlState::calculate_hash_p)
+size_t ControlFlowGraph::memory_usage() const
 {
-	;
+	return _state_arena.reserved_bytes()
+		+ _edge_arena.reserved_bytes()
+		+ states.memory_usage()
+		+ _frozen.memory_usage()
+		+ ( _explorer ? _explorer->memory_usage() : 0 );
 }
 
-ControlFlowGraph::~ControlFlowGraph()
+void ControlFlowGraph::add_edge ( const CFGEdge & e )
 {
-	for ( ControlState * x : states )
+	if ( _explorer )
+	{
+		_explorer->add_edge ( e );
+		return;
+	}
+
+	if ( _distributed )
 	{
-		delete x;
+		_distributed->add_edge ( e );
+		return;
 	}
+
+	if ( !_pending_edges.empty() && _pending_edges.front().from != e.from )
+		throw logic_error ( "All pending edges must start in the same state" );
+
+	_pending_edges.push_back ( e );
+}
+
+void ControlFlowGraph::commit_edges()
+{
+	if ( _pending_edges.empty() )
+		return;
+
+	ControlState * from = _pending_edges.front().from;
+	if ( !from->next.empty() )
+		throw logic_error ( "State already has its edges" );
+
+	CFGEdge * arr = static_cast < CFGEdge * > ( _edge_arena.allocate (
+			_pending_edges.size() * sizeof ( CFGEdge ), alignof ( CFGEdge ) ) );
+
+	for ( size_t i = 0; i < _pending_edges.size(); i++ )
+		new ( & arr[i] ) CFGEdge ( _pending_edges[i] );
+
+	from->next.edges = arr;
+	from->next.n = _pending_edges.size();
+	_pending_edges.clear();
 }
 
 bool ControlFlowGraph::explore_next_edge()
 {
 	// Go back to top state, which is not closed yet
-	while ( current && current->di.visited_next >= current->next.size() )
+	while ( !_stack.empty() && _stack.back().next_edge >= _stack.back().cs->next.size() )
 	{
-		ControlState * up = current->di.reached_from;
-		current->di.st = ControlState::DFSInfo::St::Closed;
-		current->di.reached_from = nullptr;
-		current = up;
+		SearchFrame & top = _stack.back();
+		top.cs->st = top.revisit ? top.prev : ControlState::St::Closed;
+		_stack.pop_back();
 	}
 
-	if ( ! current )
+	if ( _stack.empty() )
 		return false;
 
-	// now current->di.visited_next < current->next.size()
+	// now top.next_edge < top.cs->next.size()
 	// So visit next
-	CFGEdge & edge = current->next[ current->di.visited_next ];
-	// After this point, nobody should should modify current->next
-	current->di.visited_next++;
+	SearchFrame & top = _stack.back();
+	CFGEdge & edge = top.cs->next[ top.next_edge ];
+	// After this point, nobody should should modify top.cs->next
+	top.next_edge++;
+
+	if ( ( top.skip >> edge.pid ) & 1 )
+		return true;
 
 	// Each edge is visited exactly once
-	edges.push_back ( & edge );
+	_n_edges++;
 
 	if ( _edge_visitor )
+	{
 		(*_edge_visitor) ( edge );
+		commit_edges();
+	}
+
+	std::uint64_t sleep = 0;
+	if ( _sleep_sets )
+	{
+		sleep = child_sleep ( top, edge );
+		top.fired |= std::uint64_t ( 1 ) << edge.pid;
+	}
 
-	if ( edge.to.di.st == ControlState::DFSInfo::St::New )
+	if ( edge.to.st == ControlState::St::New )
 	{
-		edge.to.di.reached_from = current;
-		edge.to.di.st = ControlState::DFSInfo::St::On_stack;
-		current = & edge.to;
+		edge.to.st = ControlState::St::On_stack;
+		_stack.push_back ( SearchFrame { & edge.to, 0, sleep, sleep, 0, false,
+				ControlState::St::New } );
+		if ( sleep )
+			_sleep [ & edge.to ] = sleep;
+	}
+	else if ( _sleep_sets )
+	{
+		revisit ( edge.to, sleep );
 	}
 
 	return true;
 }
 
-bool ControlFlowGraph::has_state ( ControlState & cs ) const
+std::uint64_t ControlFlowGraph::child_sleep ( const SearchFrame & top, const CFGEdge & e ) const
+{
+	// Edges of each process are contiguous, so processes fired before 'e'
+	// have all their edges explored.
+	const std::uint64_t me = std::uint64_t ( 1 ) << e.pid;
+	std::uint64_t candidates = ( top.sleep | top.fired ) & ~me;
+	std::uint64_t sleep = 0;
+
+	while ( candidates )
+	{
+		unsigned int p = __builtin_ctzll ( candidates );
+		candidates &= candidates - 1;
+
+		if ( _edge_visitor->independent ( * _layout.state ( top.cs->processes(), p ), *e.t ) )
+			sleep |= std::uint64_t ( 1 ) << p;
+	}
+
+	return sleep;
+}
+
+void ControlFlowGraph::revisit ( ControlState & cs, std::uint64_t sleep )
+{
+	auto it = _sleep.find ( & cs );
+	if ( it == _sleep.end() )
+		return;
+
+	// Processes sleeping in 'cs' before, but not on this path
+	const std::uint64_t wake = it->second & ~sleep;
+	if ( !wake )
+		return;
+
+	it->second &= sleep;
+	const std::uint64_t remains = it->second;
+	if ( !remains )
+		_sleep.erase ( it );
+
+	_stack.push_back ( SearchFrame { & cs, 0, remains, ~wake, 0, true, cs.st } );
+	cs.st = ControlState::St::On_stack;
+}
+
+size_t ControlFlowGraph::prune_sleeping_edges()
+{
+	size_t removed = 0;
+	for ( const auto & p : _sleep )
+	{
+		EdgeList & next = const_cast < ControlState * > ( p.first )->next;
+		unsigned int n = 0;
+		for ( unsigned int i = 0; i < next.size(); i++ )
+		{
+			if ( ( p.second >> next[i].pid ) & 1 )
+				continue;
+
+			if ( n != i )
+				new ( & next[n] ) CFGEdge ( next[i] );
+			n++;
+		}
+
+		removed += next.n - n;
+		next.n = n;
+	}
+
+	_sleep.clear();
+	return removed;
+}
+
+void ControlFlowGraph::successor_key ( const ControlState & cs, unsigned int pid,
+		const State * to, SuccessorKey & key ) const
 {
-	auto found = states.find ( & cs );
-	return found != states.cend();
+	key.processes.resize ( _layout.stride() );
+	memcpy ( key.processes.data(), cs.processes(), _layout.stride() );
+	key.hash = cs.hash;
+	key.moved_to = _layout.move ( key.processes.data(), key.hash, pid, _layout.id ( to ) );
 }
 
-ControlState * ControlFlowGraph::get_state ( ControlState & cs ) const
+ControlState * ControlFlowGraph::get_state ( const SuccessorKey & key ) const
 {
-	auto found = states.find ( & cs );
+	if ( _explorer )
+		return _explorer->find ( key );
 
-	if ( found != states.cend() )
-		return *found;
+	if ( _distributed )
+		return _distributed->find ( key );
 
-	return nullptr;
+	return states.find ( key.processes.data(), key.hash );
 }
 
-ControlState & ControlFlowGraph::insert_state ( ControlState & cs )
+ControlState & ControlFlowGraph::insert_state ( const SuccessorKey & key )
 {
-	auto found = states.find ( & cs );
+	if ( _explorer )
+		return _explorer->insert ( key );
+
+	if ( _distributed )
+		return _distributed->insert ( key );
 
-	if ( found == states.cend() )
+	auto create = [this, &key] () -> ControlState *
 	{
-		states.insert ( & cs );
+		void * mem = _state_arena.allocate (
+				sizeof ( ControlState ) + _layout.stride(), alignof ( ControlState ) );
+		ControlState * cs = new ( mem ) ControlState ( key.hash, states.size() );
+		memcpy ( cs->processes(), key.processes.data(), _layout.stride() );
 		return cs;
-	} else {
+	};
+
+	return * states.find_or_insert ( key.processes.data(), key.hash, create ).first;
+}
+
+void ControlFlowGraph::freeze()
+{
+	if ( _is_frozen )
+		throw logic_error ( "Graph is already frozen" );
+
+	if ( _layout.n_processes() > 0x100 )
+		throw logic_error ( "Too many processes for frozen graph" );
+
+	if ( _n_edges > 0xffffffffu )
+		throw logic_error ( "Too many edges for frozen graph" );
+
+	// Sleep sets may leave some states unreachable
+	if ( _explorer || _distributed || _sleep_sets )
+	{
+		number_states();
+	}
+	else
+	{
+		_frozen.states.resize ( states.size() );
+		for ( ControlState * cs : states )
+			_frozen.states[cs->id] = cs;
+	}
+
+	_frozen.initial = initial->id;
+
+	std::unordered_map < const Transition *, std::uint32_t > transition_ids;
+
+	_frozen.offsets.reserve ( states.size() + 1 );
+	_frozen.targets.reserve ( _n_edges );
+	_frozen.transitions.reserve ( _n_edges );
+	_frozen.pids.reserve ( _n_edges );
+	if ( _layout.symmetric() )
+		_frozen.moved_to.reserve ( _n_edges );
+
+	for ( ControlState * cs : _frozen.states )
+	{
+		_frozen.offsets.push_back ( _frozen.targets.size() );
+		for ( const CFGEdge & e : cs->next )
+		{
+			auto it = transition_ids.find ( e.t );
+			if ( it == transition_ids.end() )
+			{
+				it = transition_ids.insert ( std::make_pair (
+					e.t, std::uint32_t ( _frozen.transition_table.size() ) ) ).first;
+				_frozen.transition_table.push_back ( e.t );
+			}
 
-		// Caller did not own cs state, because we are the owner.
-		// We have it in our set! We may have deleted our own state :-(
-		if ( &cs == *found)
-			throw logic_error ( "Precondition failed: caller does not own given state" );
+			_frozen.targets.push_back ( e.to.id );
+			_frozen.transitions.push_back ( it->second );
+			_frozen.pids.push_back ( std::uint8_t ( e.pid ) );
+			if ( _layout.symmetric() )
+				_frozen.moved_to.push_back ( std::uint8_t ( e.moved_to ) );
+		}
 
-		delete & cs;
-		return **found;
+		cs->next = EdgeList();
 	}
+	_frozen.offsets.push_back ( _frozen.targets.size() );
+
+	_edge_arena.clear();
+	if ( _explorer )
+		_explorer->release_edges();
+	_is_frozen = true;
 }
 
-ControlFlowGraph * ControlFlowGraph::build ( const Nts & n, const EdgeVisitorGenerator & gen )
+void ControlFlowGraph::number_states()
 {
-	ControlFlowGraph * cfg = new ControlFlowGraph ( n );
-	cfg->_edge_visitor =  gen ( *cfg );
+	// State is numbered iff it is at its position in _frozen.states
+	auto number = [this] ( ControlState & cs )
+	{
+		if ( cs.id < _frozen.states.size() && _frozen.states[cs.id] == & cs )
+			return;
+
+		cs.id = _frozen.states.size();
+		_frozen.states.push_back ( & cs );
+	};
+
+	// Sequential search creates successors of a state when the state is entered
+	auto enter = [this, &number] ( ControlState & cs )
+	{
+		for ( CFGEdge & e : cs.next )
+			number ( e.to );
+
+		cs.st = ControlState::St::On_stack;
+		_stack.push_back ( SearchFrame { & cs, 0 } );
+	};
+
+	_frozen.states.clear();
+	_frozen.states.reserve ( _explorer ? _explorer->n_states() : states.size() );
+
+	number ( *initial );
+	enter ( *initial );
+	while ( !_stack.empty() )
+	{
+		SearchFrame & top = _stack.back();
+		if ( top.next_edge >= top.cs->next.size() )
+		{
+			_stack.pop_back();
+			continue;
+		}
 
-	ControlState * initial = initial_control_state ( n );
-	cfg->states.insert ( initial );
-	(*cfg->_edge_visitor) ( CFGEdge ( nullptr, *initial, nullptr, 0 ) );
-	initial->di.st = ControlState::DFSInfo::St::On_stack;
+		ControlState & to = top.cs->next[ top.next_edge++ ].to;
+		if ( to.st != ControlState::St::On_stack )
+			enter ( to );
+	}
 
-	cfg->current = initial;
+	for ( ControlState * cs : _frozen.states )
+		cs->st = ControlState::St::Closed;
+}
 
-	while ( cfg->explore_next_edge() )
-		;
+ControlFlowGraph * ControlFlowGraph::build ( const Nts & n, const EdgeVisitorGenerator & gen,
+		const SeqOptions & opts )
+{
+	ControlFlowGraph * cfg = new ControlFlowGraph ( n, opts );
 
-	delete cfg->_edge_visitor;
+	ControlState * initial = cfg->initial_control_state();
+	cfg->initial = initial;
 
-	cout << "Total states: " << cfg->states.size()
-		 << " edges: " << cfg->edges.size() << "\n";
+	if ( cfg->_explorer )
+	{
+		cfg->_explorer->explore ( *initial, gen );
+		cfg->_n_edges = cfg->_explorer->n_edges();
+	}
+	else if ( cfg->_distributed )
+	{
+		cfg->_distributed->explore ( *initial, gen );
+	}
+	else
+	{
+		cfg->_edge_visitor =  gen ( *cfg );
+		cfg->states.find_or_insert ( initial );
+		(*cfg->_edge_visitor) ( CFGEdge ( nullptr, *initial, nullptr, 0 ) );
+		cfg->commit_edges();
+		initial->st = ControlState::St::On_stack;
+		cfg->_stack.push_back ( SearchFrame { initial, 0 } );
+
+		while ( cfg->explore_next_edge() )
+			;
+
+		delete cfg->_edge_visitor;
+		cfg->_edge_visitor = nullptr;
+	}
+
+	const size_t pruned = cfg->_sleep_sets ? cfg->prune_sleeping_edges() : 0;
+
+	cfg->freeze();
+
+	if ( cfg->_sleep_sets )
+	{
+		cout << "Sleep sets pruned " << pruned << " edges and "
+			 << cfg->states.size() - cfg->_frozen.n_states() << " states\n";
+	}
+
+	cout << "Total states: " << cfg->_frozen.n_states()
+		 << " edges: " << cfg->_frozen.n_edges() << "\n";
+
+	if ( cfg->_frozen.n_states() > 0 )
+	{
+		cout << "Bytes per state: "
+			 << cfg->memory_usage() / cfg->_frozen.n_states()
+			 << " (process vector: " << cfg->_layout.stride() << " bytes, "
+			 << cfg->_layout.n_local_states() << " local states)\n";
+	}
+
+	if ( cfg->_layout.symmetric() )
+	{
+		double represented = 0;
+		for ( const ControlState * cs : cfg->_frozen.states )
+			represented += cfg->_layout.orbit_size ( cs->processes() );
+
+		cout << "Symmetry: " << cfg->_frozen.n_states()
+			 << " states represent " << represented << " control states\n";
+	}
 
 	return cfg;
 }
@@ -340,7 +582,7 @@ CNVariableInfo::CNVariableInfo ()
  * @pre  Q1 Given VariableUse shall not be empty
  *       Q2 u->user_data must point to valid CNVariableInfo
  */
-void variable_use_switch_by_cnvariableinfo ( const CFGEdge * e,  VariableUse & u )
+void variable_use_switch_by_cnvariableinfo ( unsigned int pid, VariableUse & u )
 {
 	if ( ! u->user_data )
 		return;
@@ -351,7 +593,7 @@ void variable_use_switch_by_cnvariableinfo ( const CFGEdge * e,  VariableUse & u
 	if ( i->global )
 		dest = i->var;
 	else
-		dest = i->instances.at ( e->pid );
+		dest = i->instances.at ( pid );
 
 	u.set ( dest );
 }
@@ -397,6 +639,13 @@ class ControlFlowGraph::NtsGenerator
 		Nts      * dest_nts;
 		BasicNts * dest_bn;
 
+		// Indexed by state id of frozen graph
+		std::vector < State * > nts_states;
+
+		// Intermediate states of symmetric mode,
+		// keyed by ( target state id, pid, moved_to )
+		std::map < std::tuple < std::uint32_t, unsigned int, unsigned int >, State * > shuffle_states;
+
 		NtsGenerator ( const ControlFlowGraph & cfg );
 		void generate_nts();
 		void clone_local_variables();
@@ -410,14 +659,14 @@ class ControlFlowGraph::NtsGenerator
 	     */
 		void create_edges();
 
-
 		/**
-		 * @pre  Q1: Every ControlState in ControlFlowGraph
-		 *           points to some state in dest_bn.
-		 *
-		 * @post R1: Every ControlState have its nts_state null.
+		 * @brief Returns state, from which a transition leads to state 'target'
+		 *        and moves local variables of process 'pid' to 'moved_to'.
+		 *        Processes in between are shifted by one towards 'pid'.
+		 * @pre  Q1: Same as for create_edges()
 		 */
-		void clear_state_mapping();
+		State & shuffle_state ( std::uint32_t target, unsigned int pid, unsigned int moved_to );
+
 
 		/**
 		 * @pre  Q1: Every variable in dest_nts,
@@ -464,7 +713,6 @@ void ControlFlowGraph::NtsGenerator::generate_nts()
 	create_states();
 	create_edges();
 
-	clear_state_mapping();
 	clear_variable_info();
 }
 
@@ -513,12 +761,14 @@ void ControlFlowGraph::NtsGenerator::clone_local_variables ( )
  */
 void ControlFlowGraph::NtsGenerator::create_states()
 {
-	unsigned int st_id = 0;
-	for ( ControlState * s : _cfg.states )
+	const FrozenGraph & fg = _cfg._frozen;
+	nts_states.resize ( fg.n_states() );
+	for ( std::uint32_t id = 0; id < fg.n_states(); id++ )
 	{
-		s->create_nts_state ( string ( "st_" ) + to_string ( st_id ) );
-		s->nts_state->insert_to ( *dest_bn );
-		st_id++;
+		State * s = fg.states[id]->create_nts_state (
+				string ( "st_" ) + to_string ( id ), _cfg._layout );
+		s->insert_to ( *dest_bn );
+		nts_states[id] = s;
 	}
 
 	 // TODO: Initial state, final state, error states.
@@ -542,43 +792,97 @@ void ControlFlowGraph::NtsGenerator::clone_global_variables()
 
 void ControlFlowGraph::NtsGenerator::create_edges()
 {
-	for ( const CFGEdge * e : _cfg.edges )
+	const FrozenGraph & fg = _cfg._frozen;
+	for ( std::uint32_t s = 0; s < fg.n_states(); s++ )
 	{
-		State * from;
-		if ( e->from )
-			from = e->from->nts_state;
-		else
-			from = _cfg.initial->nts_state;
+		State * from = nts_states[s];
+		for ( std::uint32_t e = fg.edges_begin ( s ); e < fg.edges_end ( s ); e++ )
+		{
+			State * to = nts_states[ fg.targets[e] ];
+			const Transition * orig = fg.transition_table[ fg.transitions[e] ];
+			unsigned int pid = fg.pids[e];
 
-		if ( !from )
-			throw logic_error ( "State not found" );
+			// Reached state was canonicalized,
+			// so variables of processes have to be permuted as well.
+			if ( fg.target_pid ( e ) != pid )
+				to = & shuffle_state ( fg.targets[e], pid, fg.target_pid ( e ) );
 
-		TransitionRule * tr = e->t->rule().clone();
+			TransitionRule * tr = orig->rule().clone();
 
-		// It seems like after first calling of lambda, the capture data are cleaned
-		// So we have to put that lambda into some holder, like VariableUse::visitor
-		VariableUse::visitor visitor = [e] ( VariableUse & u )
-		{
-			variable_use_switch_by_cnvariableinfo ( e, u );
-		};
+			// It seems like after first calling of lambda, the capture data are cleaned
+			// So we have to put that lambda into some holder, like VariableUse::visitor
+			VariableUse::visitor visitor = [pid] ( VariableUse & u )
+			{
+				variable_use_switch_by_cnvariableinfo ( pid, u );
+			};
 
-		visit_variable_uses modifier ( visitor );
-		modifier.visit ( *tr );
+			visit_variable_uses modifier ( visitor );
+			modifier.visit ( *tr );
 
-		Transition & t = ( *from ->* *e->to.nts_state ) ( *tr );
-		t.insert_to ( *dest_bn );
+			Transition & t = ( *from ->* *to ) ( *tr );
+			t.insert_to ( *dest_bn );
+		}
 	}
 }
 
-void ControlFlowGraph::NtsGenerator::clear_state_mapping()
+State & ControlFlowGraph::NtsGenerator::shuffle_state (
+		std::uint32_t target, unsigned int pid, unsigned int moved_to )
 {
-	for ( ControlState * cs : _cfg.states )
+	auto key = std::make_tuple ( target, pid, moved_to );
+	auto it = shuffle_states.find ( key );
+	if ( it != shuffle_states.end() )
+		return * it->second;
+
+	const BasicNts & bn = * _cfg._layout.block_of ( pid ).bnts;
+
+	// Permutation 'p' of processes: process 'j' becomes 'p(j)'
+	const unsigned int lo = std::min ( pid, moved_to );
+	const unsigned int hi = std::max ( pid, moved_to );
+	auto p = [pid, moved_to] ( unsigned int j ) -> unsigned int
 	{
-		if ( !cs->nts_state )
-			throw logic_error ( "Precondition Q1 failed" );
+		if ( j == pid )
+			return moved_to;
+		return pid < moved_to ? j - 1 : j + 1;
+	};
 
-		cs->nts_state = nullptr;
+	// v [ p(j) ]' = v [ j ] for all local variables 'v' and affected processes 'j'
+	unique_ptr < Formula > f;
+	vector < Variable * > changed;
+	for ( Variable * v : bn.variables() )
+	{
+		auto * cni = static_cast < CNVariableInfo * > ( v->user_data );
+		for ( unsigned int j = lo; j <= hi; j++ )
+		{
+			Variable * src = cni->instances.at ( j );
+			Variable * dst = cni->instances.at ( p ( j ) );
+			changed.push_back ( dst );
+
+			unique_ptr < Formula > eq ( new Relation ( RelationOp::eq,
+					unique_ptr < Term > ( new VariableReference ( *dst, true ) ),
+					unique_ptr < Term > ( new VariableReference ( *src, false ) ) ) );
+
+			if ( f )
+				f.reset ( new FormulaBop ( BoolOp::And, move ( f ), move ( eq ) ) );
+			else
+				f = move ( eq );
+		}
 	}
+
+	unique_ptr < Formula > hv ( new Havoc ( changed ) );
+	if ( f )
+		f.reset ( new FormulaBop ( BoolOp::And, move ( hv ), move ( f ) ) );
+	else
+		f = move ( hv );
+
+	State * s = new State ( string ( "st_" ) + to_string ( target )
+			+ "_shuffle_" + to_string ( pid ) + "_" + to_string ( moved_to ) );
+	s->insert_to ( *dest_bn );
+
+	Transition & t = ( *s ->* *nts_states[target] ) ( * new FormulaTransitionRule ( move ( f ) ) );
+	t.insert_to ( *dest_bn );
+
+	shuffle_states.insert ( std::make_pair ( key, s ) );
+	return *s;
 }
 
 void for_variables_owned_by ( const BasicNts & n, const std::function < void ( Variable * v ) > f )
@@ -658,20 +962,20 @@ void SimpleVisitor::operator() ( const CFGEdge & e )
 {
 	( void ) e;
 
-	switch ( e.to.di.st )
+	switch ( e.to.st )
 	{
-		case ControlState::DFSInfo::St::New:
+		case ControlState::St::New:
 			//cout << "Exploring ";
 			//e.to.print ( cout );
 			//cout << "\n";
 			explore ( e.to );
 			break;
 
-		case ControlState::DFSInfo::St::On_stack:
+		case ControlState::St::On_stack:
 			//cout << "**Reached state on stack. Ignoring.\n";
 			break;
 
-		case ControlState::DFSInfo::St::Closed:
+		case ControlState::St::Closed:
 			//cout << "**Reached closed state. Ignoring.\n";
 			break;
 	}
@@ -679,29 +983,39 @@ void SimpleVisitor::operator() ( const CFGEdge & e )
 
 void SimpleVisitor::explore ( ControlState & cs )
 {
-	for ( unsigned int i = 0; i < cs.states.size(); i++ )
+	const ProcessVectorLayout & l = g.layout();
+	unsigned int run;
+	for ( unsigned int i = 0; i < l.n_processes(); i += run )
 	{
-		const ProcessState & s = cs.states[i];
-
-		// Skip processes without assigned task
-		if ( s.bnts_state == nullptr )
-			continue;
-
-		explore ( cs, i );
+		run = l.run_length ( cs.processes(), i );
+		explore ( cs, i, run );
 	}
 }
 
-void SimpleVisitor::explore ( ControlState & cs, unsigned int pid )
+void SimpleVisitor::explore ( ControlState & cs, unsigned int pid, unsigned int run )
 {
-	const ProcessState & s = cs.states[pid];
-	for ( Transition *t : s.bnts_state->outgoing() )
+	const ProcessVectorLayout & l = g.layout();
+	const State * s = l.state ( cs.processes(), pid );
+	reached.clear();
+	for ( Transition *t : s->outgoing() )
 	{
-		auto cs_new = new ControlState();
-		cs_new->states = cs.states; // Copy
-		cs_new->states[pid].bnts_state = & t->to();
+		g.successor_key ( cs, pid, & t->to(), key );
+		reached.push_back ( std::make_pair ( & g.insert_state ( key ), key.moved_to ) );
+	}
 
-		ControlState & reached = g.insert_state ( *cs_new );
-		cs.next.push_back ( CFGEdge ( & cs, reached, t, pid ) );
+	// Every process of the run reaches the same states
+	// at the same positions, unless it stays in its local state.
+	// Each of them still needs its own edges, since their
+	// local variables differ.
+	for ( unsigned int j = pid; j < pid + run; j++ )
+	{
+		size_t i = 0;
+		for ( Transition *t : s->outgoing() )
+		{
+			const unsigned int moved_to = & t->to() == s ? j : reached[i].second;
+			g.add_edge ( CFGEdge ( & cs, * reached[i].first, t, j, moved_to ) );
+			i++;
+		}
 	}
 }
 
@@ -709,274 +1023,181 @@ void SimpleVisitor::explore ( ControlState & cs, unsigned int pid )
 // POVisitor - partial order          //
 //------------------------------------//
 
-POVisitor * POVisitor::generator::operator() ( ControlFlowGraph & g )
+AmpleStats::AmpleStats ( AmpleStrategy strategy ) :
+	strategy ( strategy ),
+	ample ( 0 ),
+	stubborn ( 0 ),
+	full ( 0 )
 {
-	return new POVisitor ( g, n );
+	for ( auto & w : wins )
+		w = 0;
 }
 
-POVisitor::POVisitor ( ControlFlowGraph & g, Nts & n ) :
-	SimpleVisitor ( g ), n ( n )
+AmpleStats::~AmpleStats()
 {
-	t = Tasks::compute_tasks ( n, "main" );
-}
+	// Nothing was expanded, e.g. a worker of distributed search
+	// failed before the coordinator collected its counts
+	if ( ample + stubborn + full == 0 )
+		return;
 
-POVisitor::~POVisitor()
-{
-	delete t;
-}
+	cout << "Expanded states: " << ample << " by ample set, "
+		 << stubborn << " by stubborn set, " << full << " fully\n";
 
-struct POVisitor::mystate
-{
-	ControlState * st;
-	bool is_my;
-	Transition & t;
-	mystate ( ControlState * st, bool my, Transition & t ) :
-		st ( st ), is_my ( my ), t ( t ) { ; }
-};
-
-// Well, there might be two edges leading to the same state,
-// but it should not be bad.
-struct POVisitor::mystates : public vector < mystate >
-{
-	~mystates()
-	{
-		for ( mystate & m : *this )
-		{
-			if ( m.is_my )
-				delete m.st;
-		}
-	}
-};
+	if ( strategy != AmpleStrategy::Cheapest )
+		return;
 
-namespace
-{
+	static const char * names [ n_strategies ] =
+		{ "first", "fewest", "local", "main-last", "cheapest" };
 
+	cout << "Ample strategies choosing the cheapest set:";
+	for ( unsigned int s = 0; s < n_strategies; s++ )
+		cout << " " << names[s] << " " << wins[s];
+	cout << " (of " << ample << ")\n";
+}
 
-// Does not modify the formula, but now it can not be const
-std::vector < const VariableUse * > all_primed_variables ( Formula & f )
+POVisitor * POVisitor::generator::operator() ( ControlFlowGraph & g )
 {
-	std::vector < const VariableUse * > uses;
-	VariableUse::visitor v = [&uses] ( const VariableUse & v)
-	{
-		switch ( v.user_type )
-		{
-			case VariableUse::UserType::VariableReference:
-				uses.push_back ( & v );
-				break;
-
-			case VariableUse::UserType::ArrayWrite:
-				uses.push_back ( & v );
-				break;
-
-			default:
-				break;
-		}
-	};
+	if ( !tasks )
+		tasks.reset ( Tasks::compute_tasks ( n, "main" ) );
 
-	visit_variable_uses vvu ( v );
-	vvu.visit ( f );
+	if ( !stats )
+		stats = std::make_shared < AmpleStats > ( strategy );
 
-	return move ( uses );
+	return new POVisitor ( g, n, tasks, strategy, stats );
 }
 
-bool is_primed_variable_reference ( const Term & t )
+POVisitor::POVisitor ( ControlFlowGraph & g, Nts & n, std::shared_ptr < Tasks > t,
+		AmpleStrategy strategy, std::shared_ptr < AmpleStats > stats ) :
+	SimpleVisitor ( g ), n ( n ), t ( move ( t ) ),
+	_strategy ( strategy ), _stats ( move ( stats ) ),
+	_futures_of ( nullptr )
 {
-	if ( t.term_type() != Term::TermType::Leaf )
-		return false;
-
-	auto & l = static_cast < const Leaf & > ( t );
-
-	if ( l.leaf_type() != Leaf::LeafType::VariableReference )
-		return false;
-
-	auto & vr = static_cast < const VariableReference & > ( t );
-	return vr.primed();
+	if ( g.parallel() )
+		compute_back_edges();
 }
 
-bool always_enabled ( const AtomicProposition & ap )
+POVisitor::~POVisitor()
 {
-	switch ( ap.aptype() )
-	{
-		case AtomicProposition::APType::BooleanTerm:
-			return false;
-
-		case AtomicProposition::APType::ArrayWrite:
-			return true;
-
-		case AtomicProposition::APType::Havoc:
-			return true;
-
-		case AtomicProposition::APType::Relation:
-		{
-			auto & r = static_cast < const Relation & > ( ap );
-			if ( is_primed_variable_reference ( r.term1() ) )
-				return true;
-			if ( is_primed_variable_reference ( r.term2() ) )
-				return true;
-			return false;
-		}
-	}
-	return false; // unreachable
+	;
 }
 
-bool only_enabled_aps ( const Formula & f )
+void POVisitor::compute_back_edges()
 {
-	switch ( f.type() )
-	{
-		case Formula::Type::AtomicProposition:
-		{
-			auto & ap = static_cast < const AtomicProposition & > ( f );
-			return always_enabled ( ap );
-		}
-
-		case Formula::Type::FormulaBop:
-		{
-			auto & fb = static_cast < const FormulaBop & > ( f );
-			if ( fb.op() != BoolOp::And )
-				return false;
-
-			return only_enabled_aps ( fb.formula_1() )
-				&& only_enabled_aps ( fb.formula_2() );
-		}
+	enum class Color { White, Gray, Black };
+	std::unordered_map < const State *, Color > color;
 
-		default:
-			return false;
-	}
-}
+	using OutIter = decltype ( std::declval < const State & > ().outgoing().cbegin() );
+	struct Frame
+	{
+		const State * s;
+		OutIter next;
+	};
 
-// assumes formula consists only of APs connected by AND
-bool all_havoc_contains ( const Formula & f, vector < const VariableUse * > vs )
-{
-	switch ( f.type() )
+	for ( const auto & b : g.layout().blocks() )
 	{
-		case Formula::Type::FormulaBop:
+		for ( const State * init : b.bnts->states() )
 		{
-			auto & fb = static_cast < const FormulaBop & > ( f );
-			if ( fb.op() != BoolOp::And )
-				return false;
-			return all_havoc_contains ( fb.formula_1(), vs )
-				&& all_havoc_contains ( fb.formula_2(), vs );
-		}
+			if ( !init->is_initial() || color[init] != Color::White )
+				continue;
 
-		case Formula::Type::AtomicProposition:
-		{
-			auto & ap = static_cast < const AtomicProposition & > ( f );
-			if ( ap.aptype() != AtomicProposition::APType::Havoc )
-				return true;
-			auto & hv = static_cast < const Havoc & > ( ap );
-			for ( const VariableUse * v : vs )
+			vector < Frame > stack;
+			color[init] = Color::Gray;
+			stack.push_back ( Frame { init, init->outgoing().cbegin() } );
+
+			while ( !stack.empty() )
 			{
-				std::function < bool ( const VariableUse & ) > cmp =
-				[v] ( const VariableUse & u ) -> bool
+				Frame & top = stack.back();
+				if ( top.next == top.s->outgoing().cend() )
 				{
-					return v->get() == u.get();
-				};
-				if ( hv.variables.cend() == std::find_if (
-					hv.variables.cbegin(),
-					hv.variables.cend(), cmp ) )
+					color[top.s] = Color::Black;
+					stack.pop_back();
+					continue;
+				}
+
+				const Transition * t = *top.next++;
+				const State * to = & t->to();
+				switch ( color[to] )
 				{
-					return false; // variable not found in havoc
+					case Color::Gray:
+						_back_edges.insert ( t );
+						break;
+
+					case Color::White:
+						color[to] = Color::Gray;
+						stack.push_back ( Frame { to, to->outgoing().cbegin() } );
+						break;
+
+					case Color::Black:
+						break;
 				}
 			}
-			return true;// Yes, havoc contains all variables from vs
 		}
-
-		default:
-			return false;
 	}
 }
 
-bool always_enabled ( const TransitionRule & r )
+// Successor of explored state through transition t.
+// If the successor is not in CFG yet, st is null
+// and the successor is created only when it is used.
+struct POVisitor::mystate
 {
-	if ( r.kind() ==  TransitionRule::Kind::Call )
-		return true;
-
-	if ( r.kind() != TransitionRule::Kind::Formula )
-		return false;
-
-	auto & ftr = static_cast < const FormulaTransitionRule & > ( r );
-	Formula & f = ftr.formula();
-	if ( ! only_enabled_aps ( f ) )
-		return false;
-
-
-	vector < const VariableUse * > prvals = all_primed_variables ( f );
-
-	if ( prvals.size() == 0 )
-		return true;
-
-	// Every primed variable can be there only once
-	sort ( prvals.begin(), prvals.end(),
-			[](const VariableUse * a, const VariableUse * b) -> bool
-			{
-				return a->get() < b->get();
-			}
-	);
-
-	auto it1 = prvals.begin();
-	auto it2 = it1 + 1;
-	while ( it2 != prvals.end() )
-	{
-		if ( (*it1)->get() == (*it2)->get() )
-			return false; // Duplicate found
-		it1++;
-		it2++;
-	}
-
-	if ( !all_havoc_contains ( f, prvals ) )
-		return false;
-
-	return true;
-}
+	ControlState * st;
+	Transition & t;
+	unsigned int moved_to;
+	mystate ( ControlState * st, Transition & t, unsigned int moved_to ) :
+		st ( st ), t ( t ), moved_to ( moved_to ) { ; }
+};
 
-} // namespace
+// Well, there might be two edges leading to the same state,
+// but it should not be bad.
+struct POVisitor::mystates : public vector < mystate > { };
 
 struct POVisitor::possible_ample
 {
 	mystates next_states;
-	Globals gs;
 };
 
 POVisitor::possible_ample POVisitor::next_states (
 		const ControlState & cs, unsigned int pid ) const
 {
 	possible_ample pa;
-	const ProcessState & s = cs.states[pid];
-	for ( Transition *t : s.bnts_state->outgoing() )
+	const ProcessVectorLayout & l = g.layout();
+	const State * s = l.state ( cs.processes(), pid );
+	for ( Transition *t : s->outgoing() )
 	{
 
-		const TransitionInfo * ti = ( const TransitionInfo * ) t->user_data;
-		pa.gs.union_with ( ti->global );
-
-		auto cs_new = new ControlState();
-		cs_new->states = cs.states; // Copy
-		cs_new->states[pid].bnts_state = & t->to();
-
 		// We want to know whether some of this newly discovered states
 		// is on the search stack.
-		ControlState * next = g.get_state ( *cs_new );
-		if ( next )
-		{
-			// We already have this state
-			delete cs_new;
-			pa.next_states.push_back ( mystate ( next, false, *t ) );
-		} else {
-			pa.next_states.push_back ( mystate ( cs_new, true, *t ) );
-		}
+		g.successor_key ( cs, pid, & t->to(), key );
+		pa.next_states.push_back ( mystate ( g.get_state ( key ), *t, key.moved_to ) );
 	}
-	// Every new state we have just discovered has 'is_my' flag true.
-	// States which does not have 'is_my' flag belong to CFG.
+	// States which are not in CFG yet have null 'st'.
 	return pa;
 }
 
 
 bool POVisitor::check_c3 ( const ControlState & cs, const mystates & my_states ) const
 {
+	// There is no single search stack in parallel mode.
+	// Ample set must not contain a back edge instead, so that every cycle
+	// contains a fully expanded state, regardless of the order of search.
+	if ( g.parallel() )
+	{
+		for ( const mystate & ms : my_states )
+		{
+			if ( _back_edges.count ( & ms.t ) )
+				return false;
+		}
+		return true;
+	}
+
 	for ( const mystate & ms : my_states )
 	{
+		// New states are not on stack
 		ControlState * s = ms.st;
+		if ( !s )
+			continue;
 
-		if ( s->di.st == ControlState::DFSInfo::St::On_stack )
+		if ( s->st == ControlState::St::On_stack )
 			return false;
 
 		// But note that state 'cs' is not marked as on stack.
@@ -989,18 +1210,12 @@ bool POVisitor::check_c3 ( const ControlState & cs, const mystates & my_states )
 	return true;
 }
 
-// Check C0: is there any transition,
-// which is enabled in all configurations of given cs?
+// Check C0: is some transition enabled in all configurations of given cs,
+// whatever other processes do?
 bool POVisitor::check_c0 ( const ControlState & cs, unsigned int pid ) const
 {
-	const ProcessState & s = cs.states[pid];
-	for ( Transition *t : s.bnts_state->outgoing() )
-	{
-		if ( always_enabled ( t->rule() ) )
-			return true;
-	}
-
-	return false;
+	const State * s = g.layout().state ( cs.processes(), pid );
+	return static_cast < const StateInfo * > ( s->user_data )->has_enabled;
 }
 
 bool POVisitor::check_c2 ( const ControlState & cs, unsigned int pid ) const
@@ -1015,74 +1230,330 @@ void POVisitor::use_ample_set ( ControlState & cs, unsigned int pid, possible_am
 	while ( !pa.next_states.empty() )
 	{
 		mystate & ms = pa.next_states.back();
-		ControlState * s;
-		if ( ms.is_my )
-			s = & g.insert_state ( *ms.st );
-		else
-			s = ms.st;
+		ControlState * s = ms.st;
+		if ( !s )
+		{
+			g.successor_key ( cs, pid, & ms.t.to(), key );
+			s = & g.insert_state ( key );
+		}
 
-		cs.next.push_back ( CFGEdge ( &cs, *s, & ms.t, pid ) );
-		ms.st = nullptr;
+		g.add_edge ( CFGEdge ( &cs, *s, & ms.t, pid, ms.moved_to ) );
 		pa.next_states.pop_back();
 	}
 }
 
-bool POVisitor::check_c1 ( const ControlState & cs, unsigned int pid, const possible_ample & pa ) const
-{
-	// Compute set of all variables, which can be used
-	// by other process.
-	// Note that in current implementation of Tasks::compute_transitive_globals()
-	// we assume that every task may cause every other task to run.
-	// It means every task's transitive_globals are the same,
-	// so unioning them here looks just like wasted time.
-	// But it will be useful later.
-	Globals other_tasks_globals;
-	for ( unsigned int i = 0; i < cs.states.size(); i++ )
-	{
-		if ( i == pid )
-			continue;
+void POVisitor::count_futures ( const ControlState & cs ) const
+{
+	if ( _futures_of == & cs )
+		return;
 
-		const ProcessState & ps = cs.states[i];
-		StateInfo * si = static_cast < StateInfo * > ( ps.bnts_state->user_data );
+	const ProcessVectorLayout & l = g.layout();
+	const size_t n_classes = t->future_classes.size();
+	_future_count.assign ( n_classes, 0 );
+	_futures = BitSet ( n_classes );
 
-		other_tasks_globals.union_with ( si->t->transitive_global );
+	unsigned int run;
+	for ( unsigned int i = 0; i < l.n_processes(); i += run )
+	{
+		run = l.run_length ( cs.processes(), i );
+		const StateInfo * si = static_cast < const StateInfo * > (
+				l.state ( cs.processes(), i )->user_data );
+		_future_count [ si->future_class ] += run;
+		_futures.set ( si->future_class );
 	}
 
-	if ( other_tasks_globals.may_collide_with ( pa.gs ) )
-		return false;
+	_futures_of = & cs;
+}
 
-	return true;
+bool POVisitor::check_c1 ( const ControlState & cs, unsigned int pid ) const
+{
+	// Transitions of 'pid' must be independent with everything,
+	// which other processes may do in the future.
+	// Row of the dependency matrix for local state of 'pid'
+	// says, which future classes of local states are dangerous.
+	// Future classes present in 'cs' are counted once per state.
+	const StateInfo * own = static_cast < const StateInfo * > (
+			g.layout().state ( cs.processes(), pid )->user_data );
+
+	count_futures ( cs );
+
+	const unsigned int c = own->future_class;
+	if ( _future_count[c] > 1 )
+		return !own->dependent_futures.intersects ( _futures );
+
+	// Own class is not present in other processes
+	_futures.reset ( c );
+	const bool independent = !own->dependent_futures.intersects ( _futures );
+	_futures.set ( c );
+	return independent;
 }
 
-bool POVisitor::try_ample ( ControlState & cs, unsigned int pid )
+bool POVisitor::check_ample ( const ControlState & cs, unsigned int pid, possible_ample & pa ) const
 {
+	// C0 and C1 depend only on local states,
+	// so they are checked before successors are looked up.
 	if ( !check_c0 ( cs, pid ) )
 		return false;
 
-	possible_ample pa = next_states ( cs, pid );
+	if ( ! check_c1 ( cs, pid ) )
+		return false;
 
 	if ( ! check_c2 ( cs, pid ) )
 		return false;
 
+	pa = next_states ( cs, pid );
+
 	if ( ! check_c3 ( cs, pa.next_states ) )
 		return false;
 
-	if ( ! check_c1 ( cs, pid, pa ) )
+	return true;
+}
+
+bool POVisitor::try_ample ( ControlState & cs, unsigned int pid )
+{
+	possible_ample pa;
+	if ( !check_ample ( cs, pid, pa ) )
 		return false;
 
 	use_ample_set ( cs, pid, pa );
 	return true;
 }
 
+struct POVisitor::candidate
+{
+	unsigned int pid;
+	possible_ample pa;
+
+	unsigned int new_states;
+	bool local; //< no transition uses global variables
+	bool main;  //< process is in the main task
+};
+
+size_t POVisitor::choose ( const vector < candidate > & cands, AmpleStrategy s )
+{
+	// Key to be minimized. Candidates are ordered by pid,
+	// so the first one wins ties.
+	auto key = [s] ( const candidate & c ) -> std::tuple < unsigned int, size_t, unsigned int >
+	{
+		const size_t succs = c.pa.next_states.size();
+		switch ( s )
+		{
+			case AmpleStrategy::First:    return std::make_tuple ( 0, 0, 0 );
+			case AmpleStrategy::Fewest:   return std::make_tuple ( 0, succs, 0 );
+			case AmpleStrategy::Local:    return std::make_tuple ( c.local ? 0 : 1, succs, 0 );
+			case AmpleStrategy::MainLast: return std::make_tuple ( c.main ? 1 : 0, 0, 0 );
+			case AmpleStrategy::Cheapest: return std::make_tuple ( 0, succs, c.new_states );
+		}
+		return std::make_tuple ( 0, 0, 0 ); // unreachable
+	};
+
+	size_t best = 0;
+	for ( size_t i = 1; i < cands.size(); i++ )
+	{
+		if ( key ( cands[i] ) < key ( cands[best] ) )
+			best = i;
+	}
+	return best;
+}
+
+bool POVisitor::choose_ample ( ControlState & cs )
+{
+	const ProcessVectorLayout & l = g.layout();
+
+	// Processes of one run of a counted block would give equal candidates,
+	// and the first of them wins ties, so only the first one is tried.
+	if ( _strategy == AmpleStrategy::First )
+	{
+		for ( unsigned int i = 0; i < l.n_processes(); i += l.run_length ( cs.processes(), i ) )
+		{
+			if ( try_ample ( cs, i ) )
+				return true;
+		}
+		return false;
+	}
+
+	vector < candidate > cands;
+	for ( unsigned int i = 0; i < l.n_processes(); i += l.run_length ( cs.processes(), i ) )
+	{
+		candidate c;
+		if ( !check_ample ( cs, i, c.pa ) )
+			continue;
+
+		const StateInfo * si = static_cast < const StateInfo * > (
+				l.state ( cs.processes(), i )->user_data );
+
+		c.pid = i;
+		c.new_states = 0;
+		// In parallel search, whether a state is new depends on timing
+		// of other workers, so it must not influence the output
+		if ( !g.parallel() )
+		{
+			for ( const mystate & ms : c.pa.next_states )
+			{
+				if ( !ms.st )
+					c.new_states++;
+			}
+		}
+		c.local = si->global.empty();
+		c.main = si->t == t->main_task;
+		cands.push_back ( std::move ( c ) );
+	}
+
+	if ( cands.empty() )
+		return false;
+
+	const size_t chosen = choose ( cands, _strategy );
+
+	if ( _strategy == AmpleStrategy::Cheapest )
+	{
+		const candidate & best = cands[chosen];
+		for ( unsigned int s = 0; s < AmpleStats::n_strategies; s++ )
+		{
+			const candidate & c = cands [ choose ( cands, AmpleStrategy ( s ) ) ];
+			if ( c.pa.next_states.size() == best.pa.next_states.size()
+					&& c.new_states == best.new_states )
+			{
+				_stats->wins[s]++;
+			}
+		}
+	}
+
+	use_ample_set ( cs, cands[chosen].pid, cands[chosen].pa );
+	return true;
+}
+
+// Stubborn sets are computed over processes, not single transitions.
+// Guards can not be evaluated on control states, so every transition
+// in the set may be enabled. Its dependency closure then contains
+// its necessary enabling set (writers of variables read by the guard),
+// and other transitions from the same local state conflict with it.
+bool POVisitor::try_stubborn ( ControlState & cs )
+{
+	const ProcessVectorLayout & l = g.layout();
+	const unsigned int n_proc = l.n_processes();
+
+	// Future classes dependent with current transitions,
+	// and future class of current local state of each process
+	vector < const BitSet * > now ( n_proc );
+	vector < unsigned int > future ( n_proc );
+	unsigned int n_active = 0;
+	for ( unsigned int i = 0; i < n_proc; i++ )
+	{
+		const State * s = l.state ( cs.processes(), i );
+		const StateInfo * si = static_cast < const StateInfo * > ( s->user_data );
+		now[i] = & si->dependent_futures;
+		future[i] = si->future_class;
+
+		if ( !s->outgoing().empty() )
+			n_active++;
+	}
+
+	// Smallest set found so far
+	vector < bool > best;
+	unsigned int best_size = n_active;
+
+	// Closures from processes of one counted run have the same size
+	for ( unsigned int key = 0; key < n_proc; key += l.run_length ( cs.processes(), key ) )
+	{
+		if ( !check_c0 ( cs, key ) )
+			continue;
+
+		vector < bool > in ( n_proc, false );
+		vector < unsigned int > work { key };
+		in[key] = true;
+		unsigned int size = 1;
+
+		while ( !work.empty() && size < best_size )
+		{
+			unsigned int q = work.back();
+			work.pop_back();
+
+			for ( unsigned int r = 0; r < n_proc; r++ )
+			{
+				if ( in[r] || !now[q]->test ( future[r] ) )
+					continue;
+
+				in[r] = true;
+				work.push_back ( r );
+				if ( !l.state ( cs.processes(), r )->outgoing().empty() )
+					size++;
+			}
+		}
+
+		if ( size < best_size )
+		{
+			best = move ( in );
+			best_size = size;
+		}
+	}
+
+	if ( best.empty() )
+		return false;
+
+	vector < possible_ample > sets;
+	for ( unsigned int i = 0; i < n_proc; i++ )
+	{
+		if ( !best[i] )
+			continue;
+
+		sets.push_back ( next_states ( cs, i ) );
+		if ( !check_c3 ( cs, sets.back().next_states ) )
+			return false;
+	}
+
+	unsigned int j = 0;
+	for ( unsigned int i = 0; i < n_proc; i++ )
+	{
+		if ( best[i] )
+			use_ample_set ( cs, i, sets[j++] );
+	}
+
+	return true;
+}
+
+bool POVisitor::independent ( const State & s, const Transition & t ) const
+{
+	auto * si = static_cast < const StateInfo * > ( s.user_data );
+	auto * ti = static_cast < const TransitionInfo * > ( t.user_data );
+	return !si->global.may_collide_with ( ti->global );
+}
+
+vector < size_t > POVisitor::counters() const
+{
+	vector < size_t > c { _stats->ample, _stats->stubborn, _stats->full };
+	for ( const auto & w : _stats->wins )
+		c.push_back ( w );
+	return c;
+}
+
+void POVisitor::add_counters ( const vector < size_t > & c )
+{
+	if ( c.size() != 3 + AmpleStats::n_strategies )
+		throw logic_error ( "Counters of another visitor" );
+
+	_stats->ample    += c[0];
+	_stats->stubborn += c[1];
+	_stats->full     += c[2];
+	for ( unsigned int s = 0; s < AmpleStats::n_strategies; s++ )
+		_stats->wins[s] += c[3 + s];
+}
+
 void POVisitor::explore ( ControlState & cs )
 {
-	for ( unsigned int i = 0; i < cs.states.size(); i++ )
+	if ( choose_ample ( cs ) )
 	{
-		if ( try_ample ( cs, i ) )
-			return;
+		_stats->ample++;
+		return;
+	}
+
+	if ( try_stubborn ( cs ) )
+	{
+		_stats->stubborn++;
+		return;
 	}
 
 	SimpleVisitor::explore ( cs );
+	_stats->full++;
 }
 
 
@@ -2,37 +2,29 @@
 #define POR_SRC_CONTROL_STATE_HPP_
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <ostream>
 #include <memory>         // std::unique_ptr
 #include <vector>
-#include <unordered_set>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 #include <libNTS/nts.hpp>
 
+#include "arena.hpp"
+#include "bitset.hpp"
+#include "frozen_graph.hpp"
+#include "nts-seq.hpp"
+#include "process_vector.hpp"
+#include "state_table.hpp"
+
 namespace nts {
 namespace seq {
 
-struct ProcessState
-{
-	/**
-	 * If bnts_state == null,
-	 * this proccess is not running any task.
-	 * But this should not happen in current implementation.
-	 *
-	 * Note that main process is always running main task.
-	 */
-	nts::State * bnts_state;
-
-	explicit ProcessState ( nts::State * s ) : bnts_state ( s ) { ; }
-
-	bool operator== ( const ProcessState & other ) const;
-	bool operator!= ( const ProcessState & other ) const;
-
-	static std::size_t calculate_hash ( const ProcessState & st );
-};
-
 struct ControlState;
 
 struct CFGEdge
@@ -45,90 +37,134 @@ struct CFGEdge
 	nts::Transition * t;
 	unsigned int pid;
 
+	// Position of process 'pid' in 'to'. Differs from pid only
+	// in symmetric mode, when the successor had to be canonicalized.
+	unsigned int moved_to;
+
+	CFGEdge ( ControlState * from, ControlState & to, nts::Transition * t,
+			unsigned int pid, unsigned int moved_to ) :
+		from ( from ), to ( to ), t ( t ), pid ( pid ), moved_to ( moved_to )
+	{
+		;
+	}
+
 	CFGEdge ( ControlState * from, ControlState & to, nts::Transition * t, unsigned int pid ) :
-		from ( from ), to ( to ), t ( t ), pid ( pid )
+		CFGEdge ( from, to, t, pid, pid )
 	{
 		;
 	}
 	// Invariant:
-	// to->states[pid].bnts_state == & t->to()
+	// local state of process moved_to in 'to' is & t->to()
 };
 
 /**
- * @brief Describes control state of serialized NTS
+ * @brief Fixed array of edges, allocated in ControlFlowGraph's arena.
  */
-struct ControlState
+struct EdgeList
 {
-	struct DFSInfo
-	{
-		enum class St
-		{
-			New,
-			On_stack,
-			Closed
-		};
+	CFGEdge * edges;
+	unsigned int n;
 
-		St st;
-		ControlState * reached_from; //< Creates search stack
-		unsigned int visited_next;
+	EdgeList() : edges ( nullptr ), n ( 0 ) { ; }
 
-		DFSInfo();
-	};
+	unsigned int size() const { return n; }
+	bool empty() const { return n == 0; }
 
-	/**
-	 * Invariant P1: if d.st > St::New, this state is expanded.
-	 */
+	CFGEdge & operator[] ( unsigned int i ) { return edges[i]; }
+	const CFGEdge & operator[] ( unsigned int i ) const { return edges[i]; }
 
-	DFSInfo di;
+	CFGEdge * begin() { return edges; }
+	CFGEdge * end() { return edges + n; }
+	const CFGEdge * begin() const { return edges; }
+	const CFGEdge * end() const { return edges + n; }
+};
+
+/**
+ * @brief Describes control state of serialized NTS
+ *
+ * Control states live in an arena of ControlFlowGraph.
+ * Packed process vector (see ProcessVectorLayout) is stored
+ * right behind the structure.
+ */
+struct ControlState
+{
+	// Search status. The search stack itself is kept by ControlFlowGraph.
+	enum class St : unsigned char
+	{
+		New,
+		On_stack,
+		Closed
+	};
 
-	// One state per process
-	std::vector < ProcessState > states;
+	// Zobrist hash of process vector (see ProcessVectorLayout)
+	std::size_t hash;
 
 	/**
 	 * States which could be reached from this state.
 	 * invariant: \forall e in next,
-	 * & e.t->from() == states[e.pid].bnts_state
+	 * & e.t->from() is local state of process e.pid
+	 *
+	 * Valid only until the graph is frozen.
 	 */
-	std::vector < CFGEdge > next;
+	EdgeList next;
 
-	nts::State * nts_state;
+	/**
+	 * Invariant P1: if st > St::New, this state is expanded.
+	 */
+	St st;
 
-	ControlState() { nts_state = nullptr ; }
+	// Dense id, in order of creation
+	std::uint32_t id;
+
+	ControlState ( std::size_t hash, std::uint32_t id ) :
+		hash ( hash ), st ( St::New ), id ( id ) { ; }
 	ControlState ( const ControlState & ) = delete;
 	ControlState ( ControlState && ) = delete;
 
-	bool operator== ( const ControlState & other ) const;
+	// One local state per process, packed according to ProcessVectorLayout.
+	unsigned char * processes()
+	{
+		return reinterpret_cast < unsigned char * > ( this + 1 );
+	}
+
+	const unsigned char * processes() const
+	{
+		return reinterpret_cast < const unsigned char * > ( this + 1 );
+	}
 
 	/**
 	 * Is this state on search stack of given st?
 	 */
 	//ControlState * on_stack ( ControlState & st ) const;
 
-	void print ( std::ostream & o ) const;
-
-
-	void create_nts_state ( std::string name );
-
-	static size_t calculate_hash ( const ControlState & cs );
-	static size_t calculate_hash_p ( const ControlState * cs );
+	void print ( std::ostream & o, const ProcessVectorLayout & l ) const;
 
+	// Returns new nts state annotated by origins of local states
+	nts::State * create_nts_state ( std::string name, const ProcessVectorLayout & l ) const;
 };
 
-ControlState * initial_control_state ( const nts::Nts & n );
+// TODO Dat si pozor na to, kde v celem programu pouzivam uordered_set. I v ilineru a prekladu.
 
-template < typename T>
-struct derref_equal
+/**
+ * @brief Process vector of a possible successor, which is not a ControlState.
+ *
+ * Visitors keep one key as a scratch buffer, so that looking up
+ * already known successors does not allocate anything.
+ */
+struct SuccessorKey
 {
-	bool operator() ( const T * a, const T * b ) const
-	{
-		return *a == *b;
-	}
-};
+	std::vector < unsigned char > processes;
+	std::size_t hash;
 
-// TODO Dat si pozor na to, kde v celem programu pouzivam uordered_set. I v ilineru a prekladu.
+	// Position of the moved process after canonicalization
+	unsigned int moved_to;
 
+	SuccessorKey() : hash ( 0 ), moved_to ( 0 ) { ; }
+};
 
 class ControlFlowGraph;
+class ParallelExplorer;
+class DistributedExplorer;
 
 class IEdgeVisitor
 {
@@ -137,6 +173,36 @@ class IEdgeVisitor
 		virtual ~IEdgeVisitor() = default;
 
 		virtual void operator() ( const CFGEdge & edge ) = 0;
+
+		/**
+		 * @brief True if transition 't' of some process commutes with
+		 *        every transition from local state 's' of another process.
+		 * Used by sleep sets. Visitors knowing nothing about
+		 * transitions answer false.
+		 */
+		virtual bool independent ( const nts::State & s, const nts::Transition & t ) const
+		{
+			( void ) s;
+			( void ) t;
+			return false;
+		}
+
+		/**
+		 * @brief Counters of the visitor. Distributed search sends them
+		 *        from worker processes to the coordinator, which adds
+		 *        them to its own visitor. Visitors without counters
+		 *        return an empty vector.
+		 */
+		virtual std::vector < std::size_t > counters() const
+		{
+			return std::vector < std::size_t > ();
+		}
+
+		// @pre c was returned by counters() of a visitor of the same type
+		virtual void add_counters ( const std::vector < std::size_t > & c )
+		{
+			( void ) c;
+		}
 };
 
 using EdgeVisitorGenerator = std::function < IEdgeVisitor * ( ControlFlowGraph & ) >;
@@ -146,22 +212,102 @@ class ControlFlowGraph
 	private:
 		const nts::Nts & original_nts;
 
-		std::unordered_set <
-			ControlState *,
-			std::function < size_t (const ControlState *) >,
-			derref_equal < ControlState >
-		> states;
+		ProcessVectorLayout _layout;
+
+		// Owns all control states and their process vectors
+		Arena _state_arena;
+		// Owns edge lists of all control states
+		Arena _edge_arena;
+
+		StateTable states;
+
+		// Number of visited edges
+		std::size_t _n_edges;
 
-		std::vector < CFGEdge * > edges;
+		// Compact form of explored graph, see freeze()
+		FrozenGraph _frozen;
+		bool _is_frozen;
+
+		// Edges added by visitor, which are not yet attached to their state
+		std::vector < CFGEdge > _pending_edges;
+
+		// Used instead of 'states' and arenas, when more workers are used
+		std::unique_ptr < ParallelExplorer > _explorer;
+
+		// Used in distributed mode. Coordinator merges its result
+		// to 'states' and arenas.
+		std::unique_ptr < DistributedExplorer > _distributed;
+		friend class DistributedExplorer;
+
+		/**
+		 * @brief Assigns ids to states, as the sequential search would do.
+		 * @pre   Exploration is finished.
+		 * @post  _frozen.states contains all reachable states,
+		 *        ordered by their new ids.
+		 */
+		void number_states();
+
+		void commit_edges();
+
+		/**
+		 * @brief Converts explored graph to FrozenGraph
+		 *        and releases all edge lists.
+		 * @pre   Exploration is finished.
+		 */
+		void freeze();
 
 		//std::set < ControlState * > unexplored_states;
 		ControlState * initial;
 
-		// If not null, current->di.st == On_stack
-		ControlState * current;
+		// Frame of depth-first search
+		struct SearchFrame
+		{
+			ControlState * cs;      //< cs->st == On_stack
+			unsigned int next_edge; //< index of next edge of cs to be visited
+
+			// Following fields are used only with sleep sets.
+			// Sets of processes are bitmasks indexed by pid.
+			std::uint64_t sleep = 0;    //< sleep set of cs
+			std::uint64_t skip = 0;     //< processes, whose edges are not visited
+			std::uint64_t fired = 0;    //< processes, whose edges were visited
+			bool revisit = false;       //< cs was expanded by some earlier frame
+			ControlState::St prev = ControlState::St::New; //< status of cs before revisit
+		};
+
+		std::vector < SearchFrame > _stack;
+
+		/**
+		 * Sleep sets: transitions of a process sleep in a state,
+		 * if they were explored from an ancestor and are independent
+		 * with everything executed since then. Edges of sleeping processes
+		 * are not visited. Stored sleep set of a state shrinks, when the state
+		 * is reached again with a smaller one, and edges of woken processes
+		 * are visited then. Edges, which were never visited, are removed
+		 * when the graph is frozen.
+		 *
+		 * Only states with non-empty sleep set are in _sleep.
+		 */
+		bool _sleep_sets;
+		std::unordered_map < const ControlState *, std::uint64_t > _sleep;
+
+		std::uint64_t child_sleep ( const SearchFrame & top, const CFGEdge & e ) const;
+		void revisit ( ControlState & cs, std::uint64_t sleep );
 
-		ControlFlowGraph ( const nts::Nts & orig_nts );
+		/**
+		 * @brief Removes edges of processes, which still sleep.
+		 * @returns Number of removed edges
+		 */
+		std::size_t prune_sleeping_edges();
+
+		ControlFlowGraph ( const nts::Nts & orig_nts, const SeqOptions & opts );
 
+		ControlState * initial_control_state();
+
+		/**
+		 * @brief Estimates number of bytes used by explored states,
+		 *        their process vectors, edges and the state set.
+		 */
+		std::size_t memory_usage() const;
 
 		void explore ( ControlState * cs, unsigned int pid );
 		void explore ( ControlState * cs );
@@ -179,24 +325,44 @@ class ControlFlowGraph
 
 		~ControlFlowGraph();
 
-		// It does not modify cs.
-		bool has_state ( ControlState & cs ) const;
+		const ProcessVectorLayout & layout() const { return _layout; }
+
+		// True if states are explored by more threads or processes at once,
+		// so that there is no single search stack.
+		bool parallel() const { return _explorer || _distributed; }
 
-		// if CFG does not have given state, returns nullptr.
-		ControlState * get_state ( ControlState & cs ) const;
+		/**
+		 * @brief Computes process vector of the state reached from cs,
+		 *        when process pid moves to local state 'to'.
+		 * In symmetric mode, the vector is canonicalized.
+		 * @post key.hash is hash of key.processes
+		 */
+		void successor_key ( const ControlState & cs, unsigned int pid,
+				const nts::State * to, SuccessorKey & key ) const;
 
-		// Caller must own the cs. After calling, this class
-		// owns given cs and it is responsible to destroy it.
-		// Therefore, cs must be allocated on heap,
-		// so it might be possible to call delete on it.
-		//
-		// If given state already exists in graph, returns the old version.
-		// Otherwise returns given cs.
-		//
-		// Returned value belongs to ControlFlofGraph
-		ControlState & insert_state ( ControlState & cs );
+		// if CFG does not have state with given process vector, returns nullptr.
+		ControlState * get_state ( const SuccessorKey & key ) const;
 
-		static ControlFlowGraph * build ( const nts::Nts & n, const EdgeVisitorGenerator & g );
+		// Returns state with given process vector.
+		// The state is created only if CFG does not have it yet.
+		ControlState & insert_state ( const SuccessorKey & key );
+
+		/**
+		 * @brief Adds edge to the state, which is being explored by visitor.
+		 * @pre All edges added during one visitor call
+		 *      must have the same 'from' state.
+		 *
+		 * In parallel mode, get_state(), insert_state() and add_edge()
+		 * may be called by visitors from more threads at once.
+		 * In distributed mode, they are called in worker processes.
+		 */
+		void add_edge ( const CFGEdge & e );
+
+		static ControlFlowGraph * build ( const nts::Nts & n, const EdgeVisitorGenerator & g,
+				const SeqOptions & opts = SeqOptions() );
+
+		// Valid after build() returns
+		const FrozenGraph & frozen() const { return _frozen; }
 
 		std::unique_ptr < nts::Nts > compute_nts();
 };
@@ -206,11 +372,19 @@ struct SimpleVisitor : public IEdgeVisitor
 	protected:
 		ControlFlowGraph & g;
 
+		// Scratch buffer for successor lookups
+		mutable SuccessorKey key;
+
+		// Successors and positions of moved process, see explore
+		std::vector < std::pair < ControlState *, unsigned int > > reached;
+
 	public:
 		SimpleVisitor ( ControlFlowGraph & g );
 		virtual ~SimpleVisitor();
 
-		void explore ( ControlState & cs, unsigned int pid );
+		// Explores processes [pid, pid + run), which are in the same local state
+		// of a counted block (see ProcessVectorLayout::run_length)
+		void explore ( ControlState & cs, unsigned int pid, unsigned int run = 1 );
 
 		virtual void explore ( ControlState & cs );
 		virtual void operator() ( const CFGEdge & e ) override;
@@ -219,27 +393,89 @@ struct SimpleVisitor : public IEdgeVisitor
 
 SimpleVisitor * SimpleVisitor_generator ( ControlFlowGraph & g );
 
+/**
+ * @brief Counts, how POVisitors expanded states.
+ * Shared by all visitors of one generator, printed when destroyed.
+ */
+struct AmpleStats
+{
+	static const unsigned int n_strategies = 5;
+
+	const AmpleStrategy strategy;
+
+	std::atomic < std::size_t > ample;
+	std::atomic < std::size_t > stubborn;
+	std::atomic < std::size_t > full;
+
+	// Only with AmpleStrategy::Cheapest: number of states, where
+	// given strategy would choose a set as cheap as the cheapest one.
+	// Indexed by AmpleStrategy.
+	std::atomic < std::size_t > wins [ n_strategies ];
+
+	AmpleStats ( AmpleStrategy strategy );
+	~AmpleStats();
+};
+
 class Tasks;
 struct POVisitor : public SimpleVisitor
 {
 	private:
 		nts::Nts & n;
-		Tasks * t;
+		std::shared_ptr < Tasks > t;
+
+		const AmpleStrategy _strategy;
+		std::shared_ptr < AmpleStats > _stats;
+
+		// Future classes of all processes in state _futures_of,
+		// and number of processes in each class
+		mutable const ControlState * _futures_of;
+		mutable BitSet _futures;
+		mutable std::vector < unsigned int > _future_count;
+
+		void count_futures ( const ControlState & cs ) const;
+
+		// Transitions closing a cycle in their BasicNts.
+		// Used as cycle proviso in parallel mode.
+		std::unordered_set < const nts::Transition * > _back_edges;
+
+		/**
+		 * @brief Finds back edges of depth-first search
+		 *        of every toplevel BasicNts.
+		 * Every cycle of the control flow graph moves some process
+		 * around a cycle of its BasicNts, so it contains a back edge.
+		 */
+		void compute_back_edges();
 
 		struct mystate;
 		struct mystates;
 		struct possible_ample;
+		struct candidate;
+
+		/**
+		 * @brief Checks conditions C0 - C3 for transitions of 'pid'.
+		 * @post If true is returned, 'pa' contains successors by them.
+		 */
+		bool check_ample ( const ControlState & cs, unsigned int pid, possible_ample & pa ) const;
+
+		static std::size_t choose ( const std::vector < candidate > & cands, AmpleStrategy s );
+
+		/**
+		 * @brief Uses some process as an ample set, chosen by _strategy.
+		 * @returns false if no process qualifies.
+		 */
+		bool choose_ample ( ControlState & cs );
 
 		possible_ample next_states (
 				const ControlState & cs, unsigned int pid ) const;
 		bool check_c0 ( const ControlState & cs, unsigned int pid ) const;
-		bool check_c1 ( const ControlState & cs, unsigned int pid, const possible_ample & pa ) const;
+		bool check_c1 ( const ControlState & cs, unsigned int pid ) const;
 		bool check_c2 ( const ControlState & cs, unsigned int pid ) const;
 		bool check_c3 ( const ControlState & cs, const mystates & ) const;
 		void use_ample_set ( ControlState & cs, unsigned int pid,  possible_ample & a ) const;
 
 	public:
-		POVisitor ( ControlFlowGraph & g, nts::Nts & n );
+		POVisitor ( ControlFlowGraph & g, nts::Nts & n, std::shared_ptr < Tasks > t,
+				AmpleStrategy strategy, std::shared_ptr < AmpleStats > stats );
 		virtual ~POVisitor();
 
 		/**
@@ -247,15 +483,44 @@ struct POVisitor : public SimpleVisitor
 		 * @pre  Q1: All transitions in .n must have computed TransitionInfo
 		 */
 		bool try_ample ( ControlState & cs, unsigned int pid );
+
+		/**
+		 * @brief Tries to use a stubborn set spanning more processes.
+		 *
+		 * Starting with a process, which has an always enabled (key)
+		 * transition, processes are added while their future
+		 * may collide with some transition already in the set.
+		 * @pre  Q1: All transitions in .n must have computed TransitionInfo
+		 * @returns false if the set would contain all processes,
+		 *          or if it would close a cycle.
+		 */
+		bool try_stubborn ( ControlState & cs );
 		virtual void explore ( ControlState & cs ) override;
 
+		/**
+		 * @pre Q1: 's' and 't' belong to some toplevel BasicNts
+		 */
+		virtual bool independent ( const nts::State & s, const nts::Transition & t ) const override;
+
+		// Counts of AmpleStats
+		virtual std::vector < std::size_t > counters() const override;
+		virtual void add_counters ( const std::vector < std::size_t > & c ) override;
+
 		struct generator;
 };
 
 struct POVisitor::generator
 {
 	nts::Nts & n;
-	generator ( nts::Nts & n ) : n ( n ) { ; }
+
+	AmpleStrategy strategy;
+
+	// Shared by all visitors created by this generator
+	std::shared_ptr < Tasks > tasks;
+	std::shared_ptr < AmpleStats > stats;
+
+	generator ( nts::Nts & n, AmpleStrategy strategy = AmpleStrategy::First ) :
+		n ( n ), strategy ( strategy ) { ; }
 
 	POVisitor * operator() ( ControlFlowGraph & g );
 };
@@ -0,0 +1,640 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "arena.hpp"
+#include "distributed_explorer.hpp"
+#include "state_table.hpp"
+
+using std::cerr;
+using std::logic_error;
+using std::memcpy;
+using std::runtime_error;
+using std::size_t;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+
+namespace nts {
+namespace seq {
+
+namespace
+{
+
+// Maximal size of one datagram with process vectors
+const size_t batch_bytes = 32 * 1024;
+
+// Number of expansions between two checks of incoming successors
+const unsigned int receive_period = 64;
+
+void write_all ( int fd, const void * data, size_t size )
+{
+	const char * p = static_cast < const char * > ( data );
+	while ( size > 0 )
+	{
+		ssize_t w = ::write ( fd, p, size );
+		if ( w < 0 && errno == EINTR )
+			continue;
+		if ( w <= 0 )
+			throw runtime_error ( string ( "Write to coordinator failed: " ) + strerror ( errno ) );
+		p += w;
+		size -= w;
+	}
+}
+
+void read_all ( int fd, void * data, size_t size )
+{
+	char * p = static_cast < char * > ( data );
+	while ( size > 0 )
+	{
+		ssize_t r = ::read ( fd, p, size );
+		if ( r < 0 && errno == EINTR )
+			continue;
+		if ( r <= 0 )
+			throw runtime_error ( "Worker process failed" );
+		p += r;
+		size -= r;
+	}
+}
+
+template < typename T >
+void write_vector ( int fd, const vector < T > & v )
+{
+	uint64_t n = v.size();
+	write_all ( fd, &n, sizeof ( n ) );
+	write_all ( fd, v.data(), n * sizeof ( T ) );
+}
+
+template < typename T >
+void read_vector ( int fd, vector < T > & v )
+{
+	uint64_t n;
+	read_all ( fd, &n, sizeof ( n ) );
+	v.resize ( n );
+	read_all ( fd, v.data(), n * sizeof ( T ) );
+}
+
+} // namespace
+
+//------------------------------------//
+// Data structures                    //
+//------------------------------------//
+
+struct DistributedExplorer::Shared
+{
+	std::atomic < long > outstanding;
+	std::atomic < bool > abort;
+};
+
+struct DistributedExplorer::WireEdge
+{
+	uint64_t transition; //< address of nts::Transition
+	uint32_t target;     //< index into owned states or proxies
+	std::uint8_t remote; //< target is a proxy
+	std::uint8_t pid;
+	std::uint8_t moved_to;
+	std::uint8_t padding;
+};
+
+struct DistributedExplorer::Partition
+{
+	const unsigned int index;
+
+	Arena state_arena;
+	Arena edge_arena;
+
+	// Owned states and proxies of states owned by others.
+	// Id of a state is its index in the corresponding vector.
+	StateTable owned_table;
+	StateTable proxy_table;
+	vector < ControlState * > owned;
+	vector < ControlState * > proxies;
+
+	// States waiting for expansion
+	vector < ControlState * > queue;
+
+	vector < CFGEdge > pending_edges;
+
+	// Process vectors to be sent, indexed by destination
+	vector < vector < unsigned char > > outgoing;
+
+	vector < unsigned char > incoming;
+
+	Partition ( unsigned int index, unsigned int n, const ProcessVectorLayout & layout, bool huge_pages ) :
+		index ( index ),
+		state_arena ( huge_pages ),
+		edge_arena ( huge_pages ),
+		owned_table ( layout ),
+		proxy_table ( layout ),
+		outgoing ( n ),
+		incoming ( batch_bytes )
+	{
+		;
+	}
+};
+
+// Partition as received by coordinator
+struct DistributedExplorer::Received
+{
+	vector < unsigned char > owned;
+	vector < unsigned char > proxies;
+	vector < uint64_t > offsets;
+	vector < WireEdge > edges;
+	vector < uint64_t > counters;
+
+	vector < ControlState * > owned_states;
+};
+
+//------------------------------------//
+// DistributedExplorer                //
+//------------------------------------//
+
+DistributedExplorer::DistributedExplorer ( ControlFlowGraph & g, const SeqOptions & opts ) :
+	_g ( g ),
+	_n ( opts.processes ),
+	_huge_pages ( opts.huge_pages )
+{
+	if ( _n == 0 )
+		throw logic_error ( "At least one worker process is needed" );
+
+	void * mem = mmap ( nullptr, sizeof ( Shared ), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	if ( mem == MAP_FAILED )
+		throw std::bad_alloc();
+
+	_shared = new ( mem ) Shared;
+	if ( !_shared->outstanding.is_lock_free() )
+		throw logic_error ( "Lock-free atomics are needed for shared memory" );
+
+	for ( unsigned int i = 0; i < _n; i++ )
+	{
+		int fds[2];
+		if ( socketpair ( AF_UNIX, SOCK_DGRAM, 0, fds ) != 0 )
+			throw runtime_error ( string ( "socketpair: " ) + strerror ( errno ) );
+
+		_recv.push_back ( fds[0] );
+		_send.push_back ( fds[1] );
+	}
+}
+
+DistributedExplorer::~DistributedExplorer()
+{
+	for ( int fd : _recv )
+		close ( fd );
+	for ( int fd : _send )
+		close ( fd );
+
+	munmap ( _shared, sizeof ( Shared ) );
+}
+
+unsigned int DistributedExplorer::owner ( size_t hash ) const
+{
+	// Low bits are used by state tables
+	return ( hash >> 40 ) % _n;
+}
+
+ControlState * DistributedExplorer::find ( const SuccessorKey & key ) const
+{
+	const unsigned char * packed = key.processes.data();
+	if ( owner ( key.hash ) == _self->index )
+		return _self->owned_table.find ( packed, key.hash );
+
+	return _self->proxy_table.find ( packed, key.hash );
+}
+
+ControlState & DistributedExplorer::insert ( const SuccessorKey & key )
+{
+	Partition & p = *_self;
+	const size_t stride = _g.layout().stride();
+	const unsigned int dest = owner ( key.hash );
+	const bool local = dest == p.index;
+
+	vector < ControlState * > & states = local ? p.owned : p.proxies;
+	auto create = [&p, &key, &states, stride] () -> ControlState *
+	{
+		void * mem = p.state_arena.allocate (
+				sizeof ( ControlState ) + stride, alignof ( ControlState ) );
+		ControlState * cs = new ( mem ) ControlState ( key.hash, states.size() );
+		memcpy ( cs->processes(), key.processes.data(), stride );
+		states.push_back ( cs );
+		return cs;
+	};
+
+	StateTable & table = local ? p.owned_table : p.proxy_table;
+	auto r = table.find_or_insert ( key.processes.data(), key.hash, create );
+	if ( !r.second )
+		return * r.first;
+
+	_shared->outstanding.fetch_add ( 1 );
+	if ( local )
+	{
+		p.queue.push_back ( r.first );
+	}
+	else
+	{
+		vector < unsigned char > & out = p.outgoing[dest];
+		if ( out.size() + stride > batch_bytes )
+			send_batch ( dest );
+		out.insert ( out.end(), key.processes.begin(), key.processes.end() );
+	}
+
+	return * r.first;
+}
+
+void DistributedExplorer::add_edge ( const CFGEdge & e )
+{
+	Partition & p = *_self;
+	if ( !p.pending_edges.empty() && p.pending_edges.front().from != e.from )
+		throw logic_error ( "All pending edges must start in the same state" );
+
+	p.pending_edges.push_back ( e );
+}
+
+void DistributedExplorer::send_batch ( unsigned int dest )
+{
+	vector < unsigned char > & out = _self->outgoing[dest];
+	if ( out.empty() )
+		return;
+
+	while ( true )
+	{
+		ssize_t r = send ( _send[dest], out.data(), out.size(), MSG_DONTWAIT );
+		if ( r >= 0 )
+			break;
+
+		if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ENOBUFS )
+			throw runtime_error ( string ( "send: " ) + strerror ( errno ) );
+
+		// Receiver is busy. Drain own socket meanwhile,
+		// so that nobody waits for us.
+		if ( !receive() )
+		{
+			pollfd pfd = { _send[dest], POLLOUT, 0 };
+			poll ( &pfd, 1, 1 );
+		}
+	}
+
+	out.clear();
+}
+
+bool DistributedExplorer::receive()
+{
+	Partition & p = *_self;
+	const size_t stride = _g.layout().stride();
+	bool received = false;
+
+	while ( true )
+	{
+		ssize_t r = recv ( _recv[p.index], p.incoming.data(), p.incoming.size(), MSG_DONTWAIT );
+		if ( r < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				return received;
+			throw runtime_error ( string ( "recv: " ) + strerror ( errno ) );
+		}
+
+		received = true;
+		SuccessorKey key;
+		for ( size_t off = 0; off + stride <= size_t ( r ); off += stride )
+		{
+			key.processes.assign ( p.incoming.begin() + off, p.incoming.begin() + off + stride );
+			key.hash = _g.layout().hash ( key.processes.data() );
+
+			// Inserting increments 'outstanding' if the state is new
+			insert ( key );
+			_shared->outstanding.fetch_sub ( 1 );
+		}
+	}
+}
+
+void DistributedExplorer::expand ( IEdgeVisitor & visitor, ControlState & cs )
+{
+	Partition & p = *_self;
+
+	visitor ( CFGEdge ( nullptr, cs, nullptr, 0 ) );
+
+	if ( !p.pending_edges.empty() )
+	{
+		CFGEdge * arr = static_cast < CFGEdge * > ( p.edge_arena.allocate (
+				p.pending_edges.size() * sizeof ( CFGEdge ), alignof ( CFGEdge ) ) );
+
+		for ( size_t i = 0; i < p.pending_edges.size(); i++ )
+			new ( & arr[i] ) CFGEdge ( p.pending_edges[i] );
+
+		cs.next.edges = arr;
+		cs.next.n = p.pending_edges.size();
+		p.pending_edges.clear();
+	}
+
+	cs.st = ControlState::St::Closed;
+	_shared->outstanding.fetch_sub ( 1 );
+}
+
+void DistributedExplorer::write_partition ( int out, const IEdgeVisitor & visitor ) const
+{
+	const Partition & p = *_self;
+	const size_t stride = _g.layout().stride();
+
+	vector < unsigned char > owned ( p.owned.size() * stride );
+	for ( size_t i = 0; i < p.owned.size(); i++ )
+		memcpy ( & owned[i * stride], p.owned[i]->processes(), stride );
+
+	vector < unsigned char > proxies ( p.proxies.size() * stride );
+	for ( size_t i = 0; i < p.proxies.size(); i++ )
+		memcpy ( & proxies[i * stride], p.proxies[i]->processes(), stride );
+
+	vector < uint64_t > offsets;
+	vector < WireEdge > edges;
+	offsets.reserve ( p.owned.size() + 1 );
+	for ( const ControlState * cs : p.owned )
+	{
+		offsets.push_back ( edges.size() );
+		for ( const CFGEdge & e : cs->next )
+		{
+			WireEdge w;
+			w.transition = reinterpret_cast < uint64_t > ( e.t );
+			w.target     = e.to.id;
+			w.remote     = owner ( e.to.hash ) != p.index;
+			w.pid        = e.pid;
+			w.moved_to   = e.moved_to;
+			w.padding    = 0;
+			edges.push_back ( w );
+		}
+	}
+	offsets.push_back ( edges.size() );
+
+	write_vector ( out, owned );
+	write_vector ( out, proxies );
+	write_vector ( out, offsets );
+	write_vector ( out, edges );
+
+	const vector < size_t > c = visitor.counters();
+	write_vector ( out, vector < uint64_t > ( c.begin(), c.end() ) );
+}
+
+void DistributedExplorer::run_worker ( unsigned int index, ControlState & initial,
+		IEdgeVisitor & visitor, int out )
+{
+	int status = 0;
+	try
+	{
+		_self.reset ( new Partition ( index, _n, _g.layout(), _huge_pages ) );
+		Partition & p = *_self;
+
+		if ( owner ( initial.hash ) == index )
+		{
+			// Counted by coordinator already
+			initial.id = 0;
+			p.owned.push_back ( & initial );
+			p.owned_table.find_or_insert ( & initial );
+			p.queue.push_back ( & initial );
+		}
+
+		while ( !_shared->abort.load() )
+		{
+			unsigned int expanded = 0;
+			while ( !p.queue.empty() && expanded++ < receive_period )
+			{
+				ControlState * cs = p.queue.back();
+				p.queue.pop_back();
+				expand ( visitor, *cs );
+			}
+
+			if ( !p.queue.empty() )
+			{
+				receive();
+				continue;
+			}
+
+			for ( unsigned int i = 0; i < _n; i++ )
+				send_batch ( i );
+
+			if ( receive() )
+				continue;
+
+			if ( _shared->outstanding.load() == 0 )
+				break;
+
+			pollfd pfd = { _recv[index], POLLIN, 0 };
+			poll ( &pfd, 1, 1 );
+		}
+
+		if ( _shared->abort.load() )
+			status = 1;
+		else
+			write_partition ( out, visitor );
+	}
+	catch ( const std::exception & e )
+	{
+		cerr << "Worker " << index << ": " << e.what() << "\n";
+		_shared->abort.store ( true );
+		status = 1;
+	}
+
+	close ( out );
+	_exit ( status );
+}
+
+void DistributedExplorer::read_partition ( int in, Received & r ) const
+{
+	read_vector ( in, r.owned );
+	read_vector ( in, r.proxies );
+	read_vector ( in, r.offsets );
+	read_vector ( in, r.edges );
+	read_vector ( in, r.counters );
+
+	const size_t stride = _g.layout().stride();
+	if ( r.owned.size() % stride || r.proxies.size() % stride
+			|| r.offsets.size() != r.owned.size() / stride + 1 )
+	{
+		throw runtime_error ( "Malformed partition" );
+	}
+}
+
+void DistributedExplorer::merge ( vector < Received > & parts )
+{
+	ControlFlowGraph & g = _g;
+	const size_t stride = g._layout.stride();
+
+	// States, including the initial one, which is already there
+	for ( Received & r : parts )
+	{
+		const size_t n = r.owned.size() / stride;
+		r.owned_states.resize ( n );
+		for ( size_t i = 0; i < n; i++ )
+		{
+			const unsigned char * packed = & r.owned[i * stride];
+			const size_t hash = g._layout.hash ( packed );
+			auto create = [&g, packed, hash, stride] () -> ControlState *
+			{
+				void * mem = g._state_arena.allocate (
+						sizeof ( ControlState ) + stride, alignof ( ControlState ) );
+				ControlState * cs = new ( mem ) ControlState ( hash, g.states.size() );
+				memcpy ( cs->processes(), packed, stride );
+				return cs;
+			};
+
+			ControlState * cs = g.states.find_or_insert ( packed, hash, create ).first;
+			cs->st = ControlState::St::Closed;
+			r.owned_states[i] = cs;
+		}
+		vector < unsigned char > ().swap ( r.owned );
+	}
+
+	// Edges
+	for ( Received & r : parts )
+	{
+		const size_t n_proxies = r.proxies.size() / stride;
+		vector < ControlState * > proxies ( n_proxies );
+		for ( size_t i = 0; i < n_proxies; i++ )
+		{
+			const unsigned char * packed = & r.proxies[i * stride];
+			proxies[i] = g.states.find ( packed, g._layout.hash ( packed ) );
+			if ( !proxies[i] )
+				throw logic_error ( "Successor is missing in its partition" );
+		}
+
+		for ( size_t i = 0; i < r.owned_states.size(); i++ )
+		{
+			const size_t begin = r.offsets[i];
+			const size_t end   = r.offsets[i + 1];
+			if ( begin == end )
+				continue;
+
+			CFGEdge * arr = static_cast < CFGEdge * > ( g._edge_arena.allocate (
+					( end - begin ) * sizeof ( CFGEdge ), alignof ( CFGEdge ) ) );
+
+			for ( size_t e = begin; e < end; e++ )
+			{
+				const WireEdge & w = r.edges[e];
+				const vector < ControlState * > & targets = w.remote ? proxies : r.owned_states;
+				if ( w.target >= targets.size() )
+					throw runtime_error ( "Malformed partition" );
+
+				new ( & arr[e - begin] ) CFGEdge ( r.owned_states[i], * targets[w.target],
+						reinterpret_cast < Transition * > ( w.transition ), w.pid, w.moved_to );
+			}
+
+			r.owned_states[i]->next.edges = arr;
+			r.owned_states[i]->next.n = end - begin;
+			g._n_edges += end - begin;
+		}
+
+		vector < WireEdge > ().swap ( r.edges );
+	}
+}
+
+void DistributedExplorer::explore ( ControlState & initial, const EdgeVisitorGenerator & gen )
+{
+	_shared->outstanding.store ( 1 );
+	_shared->abort.store ( false );
+
+	_g.states.find_or_insert ( & initial );
+
+	// Created before forking, so that workers inherit data
+	// computed by the generator, and the coordinator can sum up
+	// their counters.
+	std::unique_ptr < IEdgeVisitor > visitor ( gen ( _g ) );
+
+	vector < pid_t > children;
+	vector < int > pipes;
+
+	// Stops workers, which were started before a failure
+	auto stop_workers = [this, &children, &pipes] ()
+	{
+		_shared->abort.store ( true );
+		for ( int fd : pipes )
+			close ( fd );
+
+		for ( pid_t child : children )
+		{
+			int status;
+			while ( waitpid ( child, &status, 0 ) < 0 && errno == EINTR )
+				;
+		}
+	};
+
+	for ( unsigned int i = 0; i < _n; i++ )
+	{
+		int fds[2];
+		if ( pipe ( fds ) != 0 )
+		{
+			const string error = string ( "pipe: " ) + strerror ( errno );
+			stop_workers();
+			throw runtime_error ( error );
+		}
+
+		std::cout.flush();
+		pid_t child = fork();
+		if ( child < 0 )
+		{
+			const string error = string ( "fork: " ) + strerror ( errno );
+			close ( fds[0] );
+			close ( fds[1] );
+			stop_workers();
+			throw runtime_error ( error );
+		}
+
+		if ( child == 0 )
+		{
+			close ( fds[0] );
+			for ( int fd : pipes )
+				close ( fd );
+			run_worker ( i, initial, *visitor, fds[1] );
+		}
+
+		close ( fds[1] );
+		children.push_back ( child );
+		pipes.push_back ( fds[0] );
+	}
+
+	vector < Received > parts ( _n );
+	string error;
+	for ( unsigned int i = 0; i < _n; i++ )
+	{
+		try
+		{
+			if ( error.empty() )
+				read_partition ( pipes[i], parts[i] );
+		}
+		catch ( const std::exception & e )
+		{
+			error = e.what();
+			_shared->abort.store ( true );
+		}
+		close ( pipes[i] );
+	}
+
+	for ( pid_t child : children )
+	{
+		int status;
+		while ( waitpid ( child, &status, 0 ) < 0 && errno == EINTR )
+			;
+		if ( error.empty() && !( WIFEXITED ( status ) && WEXITSTATUS ( status ) == 0 ) )
+			error = "Worker process failed";
+	}
+
+	if ( !error.empty() )
+		throw runtime_error ( error );
+
+	for ( const Received & r : parts )
+		visitor->add_counters ( vector < size_t > ( r.counters.begin(), r.counters.end() ) );
+
+	merge ( parts );
+}
+
+} // namespace seq
+} // namespace nts
@@ -0,0 +1,101 @@
+#ifndef POR_SRC_DISTRIBUTED_EXPLORER_HPP_
+#define POR_SRC_DISTRIBUTED_EXPLORER_HPP_
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "control_flow_graph.hpp"
+#include "nts-seq.hpp"
+
+namespace nts {
+namespace seq {
+
+/**
+ * @brief Explores control flow graph using more local processes.
+ *
+ * The calling process (coordinator) forks N workers. Every control state
+ * is owned by one worker, chosen by its hash. A worker expands only
+ * states it owns. Successors owned by another worker are represented
+ * locally by a proxy state and their process vectors are sent
+ * to the owner through a Unix datagram socket, in batches.
+ *
+ * Termination: a counter in shared memory holds the number of states
+ * waiting for expansion plus the number of sent, but not yet received
+ * successors. Every worker increments it before it decrements it,
+ * so it drops to zero only when the whole search is over.
+ *
+ * When the search is over, every worker sends its partition through
+ * a pipe to the coordinator, which merges all partitions into states
+ * and edges of the ControlFlowGraph. Transitions are sent as pointers,
+ * which stay valid, because workers are forks of the coordinator.
+ * Counters of workers' visitors (see IEdgeVisitor::counters) are sent
+ * along and added to the coordinator's visitor.
+ */
+class DistributedExplorer
+{
+	private:
+		struct Partition;
+		struct Shared;
+		struct WireEdge;
+		struct Received;
+
+		ControlFlowGraph & _g;
+		const unsigned int _n;
+		const bool _huge_pages;
+
+		// _recv[i] is read by worker i, _send[i] is written by others
+		std::vector < int > _recv;
+		std::vector < int > _send;
+
+		// Mapped shared with all workers
+		Shared * _shared;
+
+		// Only in worker process: data of own partition
+		std::unique_ptr < Partition > _self;
+
+		unsigned int owner ( std::size_t hash ) const;
+
+		// Runs in forked process, never returns
+		void run_worker ( unsigned int index, ControlState & initial,
+				IEdgeVisitor & visitor, int out );
+
+		void expand ( IEdgeVisitor & visitor, ControlState & cs );
+		void send_batch ( unsigned int dest );
+		bool receive();
+		void write_partition ( int out, const IEdgeVisitor & visitor ) const;
+
+		void read_partition ( int in, Received & r ) const;
+		void merge ( std::vector < Received > & parts );
+
+	public:
+		/**
+		 * @param opts.processes  Number of worker processes
+		 */
+		DistributedExplorer ( ControlFlowGraph & g, const SeqOptions & opts );
+		~DistributedExplorer();
+
+		DistributedExplorer ( const DistributedExplorer & ) = delete;
+
+		/**
+		 * @brief Explores all states reachable from 'initial'.
+		 * @pre  Q1: 'initial' is the initial state of the graph
+		 *           and is not inserted yet.
+		 * @post R1: All reachable states are in g.states, have their edges
+		 *           and are Closed.
+		 */
+		void explore ( ControlState & initial, const EdgeVisitorGenerator & gen );
+
+		// Following methods are used by visitors in worker processes
+		ControlState * find ( const SuccessorKey & key ) const;
+		ControlState & insert ( const SuccessorKey & key );
+		void add_edge ( const CFGEdge & e );
+};
+
+} // namespace seq
+} // namespace nts
+
+#endif // POR_SRC_DISTRIBUTED_EXPLORER_HPP_
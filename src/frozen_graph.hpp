@@ -0,0 +1,73 @@
+#ifndef POR_SRC_FROZEN_GRAPH_HPP_
+#define POR_SRC_FROZEN_GRAPH_HPP_
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <libNTS/nts.hpp>
+
+namespace nts {
+namespace seq {
+
+struct ControlState;
+
+/**
+ * @brief Explored graph in compressed sparse row layout.
+ *
+ * Built by ControlFlowGraph once the exploration is finished.
+ * Edges of state with id 's' are those with index in range
+ * [ offsets[s], offsets[s+1] ). For edge 'e', targets[e] is id of
+ * reached state, transitions[e] indexes transition_table and pids[e]
+ * is the process which executed the transition.
+ * In symmetric mode, moved_to[e] is the position of that process
+ * in the target state; otherwise moved_to is empty.
+ *
+ * invariant: I1: offsets.size() == states.size() + 1
+ *            I2: targets, transitions and pids have size offsets.back()
+ *            I3: states[i]->id == i
+ */
+struct FrozenGraph
+{
+	std::vector < ControlState * > states;
+
+	std::vector < std::uint32_t > offsets;
+	std::vector < std::uint32_t > targets;
+	std::vector < std::uint32_t > transitions;
+	std::vector < std::uint8_t  > pids;
+	std::vector < std::uint8_t  > moved_to;
+
+	std::vector < nts::Transition * > transition_table;
+
+	std::uint32_t initial;
+
+	FrozenGraph() : initial ( 0 ) { ; }
+
+	std::size_t n_states() const { return states.size(); }
+	std::size_t n_edges()  const { return targets.size(); }
+
+	std::uint32_t edges_begin ( std::uint32_t s ) const { return offsets[s]; }
+	std::uint32_t edges_end   ( std::uint32_t s ) const { return offsets[s + 1]; }
+
+	unsigned int target_pid ( std::uint32_t e ) const
+	{
+		return moved_to.empty() ? pids[e] : moved_to[e];
+	}
+
+	std::size_t memory_usage() const
+	{
+		return states.capacity() * sizeof ( ControlState * )
+			+ offsets.capacity() * sizeof ( std::uint32_t )
+			+ targets.capacity() * sizeof ( std::uint32_t )
+			+ transitions.capacity() * sizeof ( std::uint32_t )
+			+ pids.capacity() * sizeof ( std::uint8_t )
+			+ moved_to.capacity() * sizeof ( std::uint8_t )
+			+ transition_table.capacity() * sizeof ( nts::Transition * );
+	}
+};
+
+} // namespace seq
+} // namespace nts
+
+#endif // POR_SRC_FROZEN_GRAPH_HPP_
@@ -1,61 +1,906 @@
 
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <vector>
+
+#include <libNTS/logic.hpp>
 #include <libNTS/variables.hpp>
 #include <libNTS/inliner.hpp>
 
 #include "logic_utils.hpp"
 
+using std::move;
+using std::set;
+using std::size_t;
+using std::sort;
+using std::vector;
 
 namespace nts {
 namespace seq {
 
 
-bool havoc_in_toplevel_conjunction ( const Formula & f )
+/**
+ * A formula determines its frame, if every variable, which is not
+ * constrained by some havoc, keeps its value. A havoc applies to
+ * the conjunction it is in. In a disjunction, each disjunct must
+ * determine its frame; the frame is then the union of their frames.
+ * Frame of other formulas (negations, implications, quantifiers)
+ * is not inferred.
+ */
+bool frame_determined ( const Formula & f )
 {
 	if ( f.type() == Formula::Type::AtomicProposition )
 	{
 		auto & ap = static_cast < const AtomicProposition & > ( f );
-		if ( ap.aptype() == AtomicProposition::APType::Havoc )
+		return ap.aptype() == AtomicProposition::APType::Havoc;
+	}
+
+	if ( f.type() == Formula::Type::FormulaBop )
+	{
+		auto & fb = static_cast < const FormulaBop & > ( f );
+		switch ( fb.op() )
+		{
+			case BoolOp::And:
+				return frame_determined ( fb.formula_1() )
+					|| frame_determined ( fb.formula_2() );
+
+			case BoolOp::Or:
+				return frame_determined ( fb.formula_1() )
+					&& frame_determined ( fb.formula_2() );
+
+			default:
+				return false;
+		}
+	}
+
+	return false;
+}
+
+namespace
+{
+
+
+// Does not modify the formula, but now it can not be const
+std::vector < const VariableUse * > all_primed_variables ( Formula & f )
+{
+	std::vector < const VariableUse * > uses;
+	VariableUse::visitor v = [&uses] ( const VariableUse & v)
+	{
+		// Reads (unprimed references, array indices) are not assignments
+		if ( !v.modifying )
+			return;
+
+		switch ( v.user_type )
+		{
+			case VariableUse::UserType::VariableReference:
+				uses.push_back ( & v );
+				break;
+
+			case VariableUse::UserType::ArrayWrite:
+				uses.push_back ( & v );
+				break;
+
+			default:
+				break;
+		}
+	};
+
+	visit_variable_uses vvu ( v );
+	vvu.visit ( f );
+
+	return move ( uses );
+}
+
+bool is_primed_variable_reference ( const Term & t )
+{
+	if ( t.term_type() != Term::TermType::Leaf )
+		return false;
+
+	auto & l = static_cast < const Leaf & > ( t );
+
+	if ( l.leaf_type() != Leaf::LeafType::VariableReference )
+		return false;
+
+	auto & vr = static_cast < const VariableReference & > ( t );
+	return vr.primed();
+}
+
+bool always_enabled ( const AtomicProposition & ap )
+{
+	switch ( ap.aptype() )
+	{
+		case AtomicProposition::APType::BooleanTerm:
+			return false;
+
+		case AtomicProposition::APType::ArrayWrite:
+			return true;
+
+		case AtomicProposition::APType::Havoc:
+			return true;
+
+		case AtomicProposition::APType::Relation:
+		{
+			auto & r = static_cast < const Relation & > ( ap );
+			if ( is_primed_variable_reference ( r.term1() ) )
+				return true;
+			if ( is_primed_variable_reference ( r.term2() ) )
+				return true;
+			return false;
+		}
+	}
+	return false; // unreachable
+}
+
+bool only_enabled_aps ( const Formula & f )
+{
+	switch ( f.type() )
+	{
+		case Formula::Type::AtomicProposition:
+		{
+			auto & ap = static_cast < const AtomicProposition & > ( f );
+			return always_enabled ( ap );
+		}
+
+		case Formula::Type::FormulaBop:
+		{
+			auto & fb = static_cast < const FormulaBop & > ( f );
+			if ( fb.op() != BoolOp::And )
+				return false;
+
+			return only_enabled_aps ( fb.formula_1() )
+				&& only_enabled_aps ( fb.formula_2() );
+		}
+
+		default:
+			return false;
+	}
+}
+
+// assumes formula consists only of APs connected by AND
+bool all_havoc_contains ( const Formula & f, vector < const VariableUse * > vs )
+{
+	switch ( f.type() )
+	{
+		case Formula::Type::FormulaBop:
+		{
+			auto & fb = static_cast < const FormulaBop & > ( f );
+			if ( fb.op() != BoolOp::And )
+				return false;
+			return all_havoc_contains ( fb.formula_1(), vs )
+				&& all_havoc_contains ( fb.formula_2(), vs );
+		}
+
+		case Formula::Type::AtomicProposition:
+		{
+			auto & ap = static_cast < const AtomicProposition & > ( f );
+			if ( ap.aptype() != AtomicProposition::APType::Havoc )
+				return true;
+			auto & hv = static_cast < const Havoc & > ( ap );
+			for ( const VariableUse * v : vs )
+			{
+				std::function < bool ( const VariableUse & ) > cmp =
+				[v] ( const VariableUse & u ) -> bool
+				{
+					return v->get() == u.get();
+				};
+				if ( hv.variables.cend() == std::find_if (
+					hv.variables.cbegin(),
+					hv.variables.cend(), cmp ) )
+				{
+					return false; // variable not found in havoc
+				}
+			}
+			return true;// Yes, havoc contains all variables from vs
+		}
+
+		// Guard of a locally guarded rule
+		case Formula::Type::FormulaNot:
 			return true;
+
+		default:
+			return false;
+	}
+}
+
+// Every primed variable is assigned once and havoced
+bool assigns_havoced ( Formula & f )
+{
+	vector < const VariableUse * > prvals = all_primed_variables ( f );
+
+	if ( prvals.size() == 0 )
+		return true;
+
+	// Every primed variable can be there only once
+	sort ( prvals.begin(), prvals.end(),
+			[](const VariableUse * a, const VariableUse * b) -> bool
+			{
+				return a->get() < b->get();
+			}
+	);
+
+	auto it1 = prvals.begin();
+	auto it2 = it1 + 1;
+	while ( it2 != prvals.end() )
+	{
+		if ( (*it1)->get() == (*it2)->get() )
+			return false; // Duplicate found
+		it1++;
+		it2++;
+	}
+
+	return all_havoc_contains ( f, prvals );
+}
+
+// A guard literal is a boolean term or a relation without primed
+// variables, possibly negated
+bool is_guard_literal ( const Formula & f )
+{
+	if ( f.type() == Formula::Type::FormulaNot )
+		return is_guard_literal ( static_cast < const FormulaNot & > ( f ).formula() );
+
+	if ( f.type() != Formula::Type::AtomicProposition )
+		return false;
+
+	auto & ap = static_cast < const AtomicProposition & > ( f );
+	switch ( ap.aptype() )
+	{
+		case AtomicProposition::APType::BooleanTerm:
+			return true;
+
+		case AtomicProposition::APType::Relation:
+			return ! always_enabled ( ap );
+
+		default:
+			return false;
+	}
+}
+
+/**
+ * Like only_enabled_aps, but allows one guard literal,
+ * which is then stored to 'guard'.
+ */
+bool enabled_aps_and_guard ( const Formula & f, const Formula * & guard )
+{
+	if ( is_guard_literal ( f ) )
+	{
+		if ( guard )
+			return false;
+		guard = & f;
+		return true;
+	}
+
+	switch ( f.type() )
+	{
+		case Formula::Type::AtomicProposition:
+			return always_enabled ( static_cast < const AtomicProposition & > ( f ) );
+
+		case Formula::Type::FormulaBop:
+		{
+			auto & fb = static_cast < const FormulaBop & > ( f );
+			if ( fb.op() != BoolOp::And )
+				return false;
+
+			return enabled_aps_and_guard ( fb.formula_1(), guard )
+				&& enabled_aps_and_guard ( fb.formula_2(), guard );
+		}
+
+		default:
+			return false;
+	}
+}
+
+} // namespace
+
+bool always_enabled ( const TransitionRule & r )
+{
+	if ( r.kind() ==  TransitionRule::Kind::Call )
+		return true;
+
+	if ( r.kind() != TransitionRule::Kind::Formula )
+		return false;
+
+	auto & ftr = static_cast < const FormulaTransitionRule & > ( r );
+	Formula & f = ftr.formula();
+	if ( ! only_enabled_aps ( f ) )
+		return false;
+
+	return assigns_havoced ( f );
+}
+
+const Formula * local_guard ( const Nts & n, const TransitionRule & r )
+{
+	if ( r.kind() != TransitionRule::Kind::Formula )
+		return nullptr;
+
+	auto & ftr = static_cast < const FormulaTransitionRule & > ( r );
+	Formula & f = ftr.formula();
+
+	const Formula * guard = nullptr;
+	if ( !enabled_aps_and_guard ( f, guard ) || !guard )
+		return nullptr;
+
+	if ( !assigns_havoced ( f ) )
+		return nullptr;
+
+	bool local = true;
+	VariableUse::visitor v = [ &n, &local ] ( const VariableUse & u )
+	{
+		if ( u.modifying || u->container() == & n.variables() )
+			local = false;
+	};
+
+	// Does not modify the formula
+	visit_variable_uses vvu ( v );
+	vvu.visit ( const_cast < Formula & > ( *guard ) );
+
+	return local ? guard : nullptr;
+}
+
+namespace
+{
+
+bool same_leaf ( const Term & a, const Term & b )
+{
+	if ( a.term_type() != Term::TermType::Leaf || b.term_type() != Term::TermType::Leaf )
+		return false;
+
+	auto & la = static_cast < const Leaf & > ( a );
+	auto & lb = static_cast < const Leaf & > ( b );
+	if ( la.leaf_type() != lb.leaf_type() )
+		return false;
+
+	switch ( la.leaf_type() )
+	{
+		case Leaf::LeafType::IntConstant:
+			return static_cast < const IntConstant & > ( la ).value()
+				== static_cast < const IntConstant & > ( lb ).value();
+
+		case Leaf::LeafType::VariableReference:
+		{
+			auto & va = static_cast < const VariableReference & > ( la );
+			auto & vb = static_cast < const VariableReference & > ( lb );
+			return va.primed() == vb.primed() && va.var().get() == vb.var().get();
+		}
+
+		default:
+			return false;
+	}
+}
+
+RelationOp negated ( RelationOp op )
+{
+	switch ( op )
+	{
+		case RelationOp::eq:  return RelationOp::neq;
+		case RelationOp::neq: return RelationOp::eq;
+		case RelationOp::lt:  return RelationOp::geq;
+		case RelationOp::geq: return RelationOp::lt;
+		case RelationOp::leq: return RelationOp::gt;
+		case RelationOp::gt:  return RelationOp::leq;
+	}
+	return op; // unreachable
+}
+
+// 'a' and 'b' are atomic propositions, 'b' with operator 'b_op'
+bool same_atom ( const AtomicProposition & a, const AtomicProposition & b, RelationOp b_op )
+{
+	if ( a.aptype() != b.aptype() )
+		return false;
+
+	if ( a.aptype() == AtomicProposition::APType::BooleanTerm )
+	{
+		return same_leaf ( static_cast < const BooleanTerm & > ( a ).term(),
+				static_cast < const BooleanTerm & > ( b ).term() );
 	}
 
+	if ( a.aptype() != AtomicProposition::APType::Relation )
+		return false;
+
+	auto & ra = static_cast < const Relation & > ( a );
+	auto & rb = static_cast < const Relation & > ( b );
+	return ra.op() == b_op
+		&& same_leaf ( ra.term1(), rb.term1() )
+		&& same_leaf ( ra.term2(), rb.term2() );
+}
+
+// Strips negations, returns true iff their number is odd
+bool strip_negations ( const Formula * & f )
+{
+	bool negative = false;
+	while ( f->type() == Formula::Type::FormulaNot )
+	{
+		f = & static_cast < const FormulaNot * > ( f )->formula();
+		negative = !negative;
+	}
+	return negative;
+}
+
+} // namespace
+
+bool complementary ( const Formula & a, const Formula & b )
+{
+	const Formula * pa = & a;
+	const Formula * pb = & b;
+	const bool neg_a = strip_negations ( pa );
+	const bool neg_b = strip_negations ( pb );
+
+	auto & apa = static_cast < const AtomicProposition & > ( *pa );
+	auto & apb = static_cast < const AtomicProposition & > ( *pb );
+
+	RelationOp op_b = RelationOp::eq;
+	if ( apb.aptype() == AtomicProposition::APType::Relation )
+		op_b = static_cast < const Relation & > ( apb ).op();
+
+	if ( neg_a != neg_b )
+		return same_atom ( apa, apb, op_b );
+
+	// x < y and x >= y
+	return apa.aptype() == AtomicProposition::APType::Relation
+		&& same_atom ( apa, apb, negated ( op_b ) );
+}
+
+namespace
+{
+
+/**
+ * Collects accesses to single cells of global arrays,
+ * i.e. accesses with one constant index. Index 'tid' is not
+ * a region, all threads of the generated program share it.
+ * .cell_uses counts, how many times each array occurs in such accesses,
+ * .havocs counts, how many times it occurs in havocs.
+ */
+class ArrayCellCollector
+{
+	private:
+		const Nts & n;
+
+		// Returns false if 'u' is not a global variable
+		bool global_number ( const VariableUse & u, unsigned int & number ) const
+		{
+			if ( u->container() != & n.variables() )
+				return false;
+
+			number = static_cast < const GlobalVariableInfo * > ( u->user_data )->number;
+			return true;
+		}
+
+		bool insert ( ArrayRegions & r, unsigned int array, const vector < Term * > & indices )
+		{
+			if ( indices.size() != 1 )
+				return false;
+
+			const Term & i = * indices[0];
+			if ( i.term_type() != Term::TermType::Leaf )
+				return false;
+
+			auto & l = static_cast < const Leaf & > ( i );
+			if ( l.leaf_type() != Leaf::LeafType::IntConstant )
+				return false;
+
+			r.insert_cell ( array, static_cast < const IntConstant & > ( l ).value() );
+			cell_uses [ array ]++;
+			return true;
+		}
+
+	public:
+		ArrayRegions reads;
+		ArrayRegions writes;
+		vector < unsigned int > cell_uses;
+		vector < unsigned int > havocs;
+
+		ArrayCellCollector ( const Nts & n ) :
+			n ( n ),
+			cell_uses ( n.variables().size(), 0 ),
+			havocs ( n.variables().size(), 0 )
+		{
+			;
+		}
+
+		void visit ( const Term & t )
+		{
+			switch ( t.term_type() )
+			{
+				case Term::TermType::Leaf:
+					break;
+
+				case Term::TermType::ArithmeticOperation:
+				{
+					auto & ao = static_cast < const ArithmeticOperation & > ( t );
+					visit ( ao.term1() );
+					visit ( ao.term2() );
+					break;
+				}
+
+				case Term::TermType::MinusTerm:
+					visit ( static_cast < const MinusTerm & > ( t ).term() );
+					break;
+
+				case Term::TermType::ArrayTerm:
+				{
+					auto & at = static_cast < const ArrayTerm & > ( t );
+					for ( const Term * i : at.indices() )
+						visit ( *i );
+
+					const Term & a = at.array();
+					if ( a.term_type() == Term::TermType::Leaf
+						&& static_cast < const Leaf & > ( a ).leaf_type() == Leaf::LeafType::VariableReference )
+					{
+						auto & vr = static_cast < const VariableReference & > ( a );
+						unsigned int number;
+						if ( global_number ( vr.var(), number )
+							&& insert ( vr.primed() ? writes : reads, number, at.indices() ) )
+						{
+							break;
+						}
+					}
+
+					visit ( a );
+					break;
+				}
+			}
+		}
+
+		void visit ( const Formula & f )
+		{
+			switch ( f.type() )
+			{
+				case Formula::Type::FormulaBop:
+				{
+					auto & fb = static_cast < const FormulaBop & > ( f );
+					visit ( fb.formula_1() );
+					visit ( fb.formula_2() );
+					break;
+				}
+
+				case Formula::Type::FormulaNot:
+					visit ( static_cast < const FormulaNot & > ( f ).formula() );
+					break;
+
+				case Formula::Type::QuantifiedFormula:
+					visit ( static_cast < const QuantifiedFormula & > ( f ).formula() );
+					break;
+
+				case Formula::Type::AtomicProposition:
+					visit ( static_cast < const AtomicProposition & > ( f ) );
+					break;
+			}
+		}
+
+		void visit ( const AtomicProposition & ap )
+		{
+			switch ( ap.aptype() )
+			{
+				case AtomicProposition::APType::BooleanTerm:
+					visit ( static_cast < const BooleanTerm & > ( ap ).term() );
+					break;
+
+				case AtomicProposition::APType::Relation:
+				{
+					auto & r = static_cast < const Relation & > ( ap );
+					visit ( r.term1() );
+					visit ( r.term2() );
+					break;
+				}
+
+				case AtomicProposition::APType::Havoc:
+				{
+					unsigned int number;
+					for ( const VariableUse & u : static_cast < const Havoc & > ( ap ).variables )
+					{
+						if ( global_number ( u, number ) )
+							havocs [ number ]++;
+					}
+					break;
+				}
+
+				case AtomicProposition::APType::ArrayWrite:
+				{
+					auto & aw = static_cast < const ArrayWrite & > ( ap );
+					for ( const Term * i : aw.indices_1() )
+						visit ( *i );
+					for ( const Term * i : aw.indices_2() )
+						visit ( *i );
+					for ( const Term * v : aw.values() )
+						visit ( *v );
+
+					unsigned int number;
+					if ( aw.indices_2().empty() && global_number ( aw.array(), number ) )
+						insert ( writes, number, aw.indices_1() );
+					break;
+				}
+			}
+		}
+};
+
+// Variable referenced by leaf 't', if it is primed as requested
+const Variable * referenced_variable ( const Term & t, bool primed )
+{
+	if ( t.term_type() != Term::TermType::Leaf )
+		return nullptr;
+
+	auto & l = static_cast < const Leaf & > ( t );
+	if ( l.leaf_type() != Leaf::LeafType::VariableReference )
+		return nullptr;
+
+	auto & vr = static_cast < const VariableReference & > ( t );
+	if ( vr.primed() != primed )
+		return nullptr;
+
+	return vr.var().get();
+}
+
+bool is_int_constant ( const Term & t )
+{
+	return t.term_type() == Term::TermType::Leaf
+		&& static_cast < const Leaf & > ( t ).leaf_type() == Leaf::LeafType::IntConstant;
+}
+
+/**
+ * If 'r' is x' = x + c, x' = c + x or x' = x - c (in any order of sides),
+ * where c is a constant, returns x. Otherwise returns nullptr.
+ */
+const Variable * constant_update ( const Relation & r )
+{
+	if ( r.op() != RelationOp::eq )
+		return nullptr;
+
+	const Term * value = & r.term2();
+	const Variable * x = referenced_variable ( r.term1(), true );
+	if ( !x )
+	{
+		value = & r.term1();
+		x = referenced_variable ( r.term2(), true );
+	}
+
+	if ( !x || value->term_type() != Term::TermType::ArithmeticOperation )
+		return nullptr;
+
+	auto & ao = static_cast < const ArithmeticOperation & > ( *value );
+	switch ( ao.op() )
+	{
+		case ArithOp::Add:
+			if ( referenced_variable ( ao.term2(), false ) == x && is_int_constant ( ao.term1() ) )
+				return x;
+			// fall through
+
+		case ArithOp::Sub:
+			if ( referenced_variable ( ao.term1(), false ) == x && is_int_constant ( ao.term2() ) )
+				return x;
+			return nullptr;
+
+		default:
+			return nullptr;
+	}
+}
+
+/**
+ * Counts constant updates of global variables, which are not under
+ * a negation or quantifier. Each disjunct then only adds some constant
+ * (or zero, if it keeps the variable), so such transitions commute.
+ */
+void count_constant_updates ( const Nts & n, const Formula & f, vector < unsigned int > & updates )
+{
+	if ( f.type() == Formula::Type::FormulaBop )
+	{
+		auto & fb = static_cast < const FormulaBop & > ( f );
+		if ( fb.op() == BoolOp::And || fb.op() == BoolOp::Or )
+		{
+			count_constant_updates ( n, fb.formula_1(), updates );
+			count_constant_updates ( n, fb.formula_2(), updates );
+		}
+		return;
+	}
+
+	if ( f.type() != Formula::Type::AtomicProposition )
+		return;
+
+	auto & ap = static_cast < const AtomicProposition & > ( f );
+	if ( ap.aptype() != AtomicProposition::APType::Relation )
+		return;
+
+	const Variable * x = constant_update ( static_cast < const Relation & > ( ap ) );
+	if ( x && x->container() == & n.variables() )
+		updates [ static_cast < const GlobalVariableInfo * > ( x->user_data )->number ]++;
+}
+
+// If 'f' is x' = x (in any order of sides), returns the primed use of x
+const VariableUse * identity ( const Formula & f )
+{
+	if ( f.type() != Formula::Type::AtomicProposition )
+		return nullptr;
+
+	auto & ap = static_cast < const AtomicProposition & > ( f );
+	if ( ap.aptype() != AtomicProposition::APType::Relation )
+		return nullptr;
+
+	auto & r = static_cast < const Relation & > ( ap );
+	if ( r.op() != RelationOp::eq )
+		return nullptr;
+
+	const Term * primed = & r.term1();
+	const Variable * x = referenced_variable ( *primed, true );
+	if ( !x || referenced_variable ( r.term2(), false ) != x )
+	{
+		primed = & r.term2();
+		x = referenced_variable ( *primed, true );
+		if ( !x || referenced_variable ( r.term1(), false ) != x )
+			return nullptr;
+	}
+
+	return & static_cast < const VariableReference & > ( *primed ).var();
+}
+
+/**
+ * Collects primed uses of identities x' = x, which are not under
+ * a negation, implication or quantifier. Such an identity
+ * keeps the variable, so it does not write it.
+ */
+void collect_identities ( const Formula & f, set < const VariableUse * > & out )
+{
+	if ( f.type() == Formula::Type::FormulaBop )
+	{
+		auto & fb = static_cast < const FormulaBop & > ( f );
+		if ( fb.op() == BoolOp::And || fb.op() == BoolOp::Or )
+		{
+			collect_identities ( fb.formula_1(), out );
+			collect_identities ( fb.formula_2(), out );
+		}
+		return;
+	}
+
+	const VariableUse * u = identity ( f );
+	if ( u )
+		out.insert ( u );
+}
+
+// Global variables kept by identities, which are conjuncts of 'f'
+void kept_globals ( const Nts & n, const Formula & f, BitSet & kept )
+{
 	if ( f.type() == Formula::Type::FormulaBop )
 	{
 		auto & fb = static_cast < const FormulaBop & > ( f );
 		if ( fb.op() == BoolOp::And )
 		{
-			return havoc_in_toplevel_conjunction ( fb.formula_1() )
-				|| havoc_in_toplevel_conjunction ( fb.formula_2() ) ; 
+			kept_globals ( n, fb.formula_1(), kept );
+			kept_globals ( n, fb.formula_2(), kept );
 		}
+		return;
 	}
 
-	return false;
+	const VariableUse * u = identity ( f );
+	if ( u && ( *u )->container() == & n.variables() )
+		kept.set ( static_cast < const GlobalVariableInfo * > ( ( *u )->user_data )->number );
+}
+
+/**
+ * Global variables in the frame of 'f', which are not listed
+ * by any havoc: a conjunction without havoc leaves every variable
+ * unconstrained, unless it keeps it by an identity x' = x.
+ * The frame of a disjunction is the union of frames of disjuncts.
+ */
+void unconstrained_globals ( const Nts & n, const Formula & f, BitSet & out )
+{
+	if ( frame_determined ( f ) )
+		return;
+
+	if ( f.type() == Formula::Type::FormulaBop )
+	{
+		auto & fb = static_cast < const FormulaBop & > ( f );
+		if ( fb.op() == BoolOp::Or )
+		{
+			unconstrained_globals ( n, fb.formula_1(), out );
+			unconstrained_globals ( n, fb.formula_2(), out );
+			return;
+		}
+	}
+
+	BitSet kept ( out.size() );
+	kept_globals ( n, f, kept );
+	for ( size_t i = 0; i < out.size(); i++ )
+	{
+		if ( !kept.test ( i ) )
+			out.set ( i );
+	}
 }
 
+} // namespace
+
 Globals used_global_variables ( const Nts & n, const Transition & t )
 {
-	Globals g;
+	const size_t n_globals = n.variables().size();
+	Globals g ( n_globals );
+
+	// How many times each global variable is used
+	vector < unsigned int > uses ( n_globals, 0 );
 
+	set < const VariableUse * > identities;
 	if ( t.rule().kind() == TransitionRule::Kind::Formula )
 	{
 		auto & ftr = static_cast < const FormulaTransitionRule & > ( t.rule() );
-		if ( ! havoc_in_toplevel_conjunction ( ftr.formula() ) )
-			g.writes.insert_everything();
+		collect_identities ( ftr.formula(), identities );
 	}
 
-	VariableUse::visitor v = [ &g, &n ] ( const VariableUse & u )
+	VariableUse::visitor v = [ &g, &n, &uses, &identities ] ( const VariableUse & u )
 	{
 		if ( u->container() == & n.variables() )
 		{
-			if ( u.modifying )
-				g.writes.insert ( u.get() );
-			else
-				g.reads.insert ( u.get() );
+			auto * gi = static_cast < const GlobalVariableInfo * > ( u->user_data );
+			uses [ gi->number ]++;
+			// Havoc lists the frame, i.e. variables which may change.
+			// Primed side of an identity keeps the variable, other side reads it.
+			if ( u.user_type == VariableUse::UserType::Havoc
+					|| ( u.modifying && !identities.count ( & u ) ) )
+				g.writes.insert ( gi->number );
+			else if ( !u.modifying )
+				g.reads.insert ( gi->number );
 		}
 	};
 
 	visit_variable_uses vvu ( v );
 	vvu.visit ( t.rule() );
 
+	if ( t.rule().kind() != TransitionRule::Kind::Formula )
+		return g;
+
+	// Variables outside of havocs are written, unless they are kept
+	auto & ftr = static_cast < const FormulaTransitionRule & > ( t.rule() );
+	BitSet unconstrained ( n_globals );
+	unconstrained_globals ( n, ftr.formula(), unconstrained );
+	g.writes.vars.union_with ( unconstrained );
+
+	// Arrays used only through cells (and havoced, if some cell is written)
+	// are represented by regions. Other arrays are used as a whole.
+	ArrayCellCollector cc ( n );
+	cc.visit ( ftr.formula() );
+
+	BitSet written ( n_globals );
+	cc.writes.arrays ( written );
+
+	BitSet whole ( n_globals );
+	for ( unsigned int i = 0; i < n_globals; i++ )
+	{
+		if ( cc.cell_uses[i] == 0 )
+			continue;
+
+		// Other cells of an unconstrained array may change as well
+		const unsigned int expected = cc.cell_uses[i] + ( written.test ( i ) ? cc.havocs[i] : 0 );
+		if ( uses[i] != expected || unconstrained.test ( i ) )
+		{
+			whole.set ( i );
+			continue;
+		}
+
+		g.reads.reset ( i );
+		g.writes.vars.reset ( i );
+	}
+
+	cc.reads.erase ( whole );
+	cc.writes.erase ( whole );
+	g.read_regions = move ( cc.reads );
+	g.write_regions = move ( cc.writes );
+
+	// A havoced scalar, which is otherwise used only by constant updates,
+	// is updated commutatively. It is not read by guards, so other
+	// updates can not disable the transition.
+	vector < unsigned int > updates ( n_globals, 0 );
+	count_constant_updates ( n, ftr.formula(), updates );
+	for ( unsigned int i = 0; i < n_globals; i++ )
+	{
+		if ( cc.cell_uses[i] != 0 || cc.havocs[i] == 0 || unconstrained.test ( i ) )
+			continue;
+
+		// Each update references the variable twice
+		if ( uses[i] != cc.havocs[i] + 2 * updates[i] )
+			continue;
+
+		g.reads.reset ( i );
+		g.writes.vars.reset ( i );
+		g.updates.set ( i );
+	}
+
+	g.normalize();
+
 	return g;
 }
 
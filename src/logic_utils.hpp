@@ -11,6 +11,43 @@
 namespace nts {
 namespace seq {
 
+/**
+ * @brief True iff the rule is enabled in every valuation of variables,
+ *        i.e. it only assigns primed variables (each one once),
+ *        and every one of them is havoced.
+ */
+bool always_enabled ( const nts::TransitionRule & r );
+
+/**
+ * @brief Guard of a rule, which is enabled iff one literal over local
+ *        variables holds, i.e. other threads can not enable or disable it.
+ *        Apart from the guard, the rule is as in always_enabled.
+ * @returns The guard literal, or nullptr if the rule is not of this form.
+ */
+const nts::Formula * local_guard ( const nts::Nts & n, const nts::TransitionRule & r );
+
+/**
+ * @brief True iff guard literals 'a' and 'b' are known to be
+ *        negations of each other, e.g. 'x < y' and 'not x < y' or 'x >= y'.
+ * @pre Both are results of local_guard.
+ */
+bool complementary ( const nts::Formula & a, const nts::Formula & b );
+
+/**
+ * @brief True iff it is known, which variables may be changed by
+ *        transition with formula 'f'.
+ */
+bool frame_determined ( const nts::Formula & f );
+
+/**
+ * @brief Global variables read and possibly written by the transition.
+ *
+ * Writes are variables assigned by the transition and variables in its
+ * frame (havoc). A conjunction without havoc may change every variable,
+ * except those it keeps by an identity x' = x, so they are written too.
+ *
+ * @pre Every global variable has associated GlobalVariableInfo.
+ */
 Globals used_global_variables ( const nts::Nts & n, const nts::Transition & t );
 
 } // namespace nts
@@ -15,17 +15,17 @@ namespace nts
 using namespace nts::seq;
 
 
-unique_ptr < Nts > sequentialize ( Nts & n, SeqMode mode )
+unique_ptr < Nts > sequentialize ( Nts & n, SeqMode mode, const SeqOptions & opts )
 {
 	ControlFlowGraph * cfg = nullptr;
 	switch ( mode )
 	{
 		case SeqMode::Simple:
-			cfg = ControlFlowGraph::build ( n, SimpleVisitor_generator );
+			cfg = ControlFlowGraph::build ( n, SimpleVisitor_generator, opts );
 			break;
 
 		case SeqMode::PartialOrderReduction:
-			cfg = ControlFlowGraph::build ( n, POVisitor::generator ( n ) );
+			cfg = ControlFlowGraph::build ( n, POVisitor::generator ( n, opts.ample ), opts );
 			break;
 	}
 	unique_ptr < Nts > result = cfg->compute_nts();
@@ -15,7 +15,86 @@ enum class SeqMode
 	PartialOrderReduction
 };
 
-std::unique_ptr < nts::Nts > sequentialize ( nts::Nts & n, SeqMode mode );
+/**
+ * Which process is used as an ample set, if more of them qualify.
+ */
+enum class AmpleStrategy
+{
+	First,     //< first process by index
+	Fewest,    //< process with fewest successors
+	Local,     //< process without global variables, then fewest successors
+	MainLast,  //< processes of the main task last, otherwise by index
+	Cheapest   //< fewest successors, then fewest new states
+	           //  (not in parallel search, to stay deterministic);
+	           //  counts how often other strategies choose as well
+};
+
+struct SeqOptions
+{
+	/**
+	 * Back arenas of explored graph by huge pages.
+	 * Falls back to normal pages if there are no huge pages available.
+	 */
+	bool huge_pages;
+
+	/**
+	 * Symmetry reduction: control states, which differ only by
+	 * a permutation of processes of the same Instance, are merged.
+	 * Local variables of permuted processes are permuted accordingly
+	 * in the resulting nts.
+	 *
+	 * Threads whose BasicNts reads 'tid' are not interchangeable,
+	 * so their instances are never merged. This excludes thread pools,
+	 * whose routine reads 'tid' to find its task; the instances which
+	 * were excluded are reported at startup.
+	 */
+	bool symmetry;
+
+	/**
+	 * Counter abstraction: in symmetric mode, instances with at least
+	 * this many threads store only the number of threads in each
+	 * local state. Successor states are then computed once per
+	 * nonzero counter, not once per thread. Zero disables the abstraction.
+	 */
+	unsigned int counters;
+
+	/**
+	 * Number of threads exploring the state space.
+	 * With more than one worker, partial order reduction uses
+	 * a static cycle proviso instead of the search stack.
+	 */
+	unsigned int workers;
+
+	// Seed of random choices of workers. Does not affect the result.
+	unsigned int seed;
+
+	/**
+	 * Number of worker processes of distributed exploration.
+	 * Each of them owns states with hash in its partition.
+	 * Zero means no worker processes are forked.
+	 */
+	unsigned int processes;
+
+	/**
+	 * Sleep sets: do not explore transitions, which were explored
+	 * from an ancestor state and commute with everything executed since.
+	 * Used only by sequential search without symmetry.
+	 */
+	bool sleep_sets;
+
+	AmpleStrategy ample;
+
+	SeqOptions() :
+		huge_pages ( false ), symmetry ( false ), counters ( 0 ),
+		workers ( 1 ), seed ( 0 ), processes ( 0 ), sleep_sets ( false ),
+		ample ( AmpleStrategy::First )
+	{
+		;
+	}
+};
+
+std::unique_ptr < nts::Nts > sequentialize ( nts::Nts & n, SeqMode mode,
+		const SeqOptions & opts = SeqOptions() );
 
 } // namespace nts
 
@@ -0,0 +1,263 @@
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "arena.hpp"
+#include "parallel_explorer.hpp"
+
+using std::logic_error;
+using std::memcpy;
+using std::size_t;
+
+namespace nts {
+namespace seq {
+
+struct ParallelExplorer::Worker
+{
+	const unsigned int index;
+
+	IEdgeVisitor * visitor;
+
+	Arena state_arena;
+	Arena edge_arena;
+
+	// Edges added by visitor during current expansion
+	std::vector < CFGEdge > pending_edges;
+
+	// States inserted by this worker during current expansion
+	std::vector < ControlState * > fresh;
+
+	// Guards 'queue'
+	std::mutex lock;
+	std::deque < ControlState * > queue;
+
+	std::mt19937 rng;
+
+	std::size_t n_edges;
+
+	std::exception_ptr error;
+
+	Worker ( unsigned int index, bool huge_pages, unsigned int seed ) :
+		index ( index ),
+		visitor ( nullptr ),
+		state_arena ( huge_pages ),
+		edge_arena ( huge_pages ),
+		rng ( seed + index ),
+		n_edges ( 0 )
+	{
+		;
+	}
+};
+
+thread_local ParallelExplorer::Worker * ParallelExplorer::_current = nullptr;
+
+ParallelExplorer::ParallelExplorer ( ControlFlowGraph & g, const SeqOptions & opts ) :
+	_g ( g ),
+	_states ( g.layout(), 4 * opts.workers ),
+	_pending ( 0 ),
+	_abort ( false )
+{
+	if ( opts.workers == 0 )
+		throw logic_error ( "At least one worker is needed" );
+
+	for ( unsigned int i = 0; i < opts.workers; i++ )
+		_workers.emplace_back ( new Worker ( i, opts.huge_pages, opts.seed ) );
+}
+
+ParallelExplorer::~ParallelExplorer()
+{
+	for ( auto & w : _workers )
+		delete w->visitor;
+}
+
+ControlState * ParallelExplorer::find ( const SuccessorKey & key ) const
+{
+	return _states.find ( key.processes.data(), key.hash );
+}
+
+ControlState & ParallelExplorer::insert ( const SuccessorKey & key )
+{
+	Worker & w = *_current;
+	const size_t stride = _g.layout().stride();
+
+	auto create = [&w, &key, stride] () -> ControlState *
+	{
+		void * mem = w.state_arena.allocate (
+				sizeof ( ControlState ) + stride, alignof ( ControlState ) );
+		// Final ids are assigned when the graph is frozen
+		ControlState * cs = new ( mem ) ControlState ( key.hash, 0 );
+		memcpy ( cs->processes(), key.processes.data(), stride );
+		return cs;
+	};
+
+	auto r = _states.find_or_insert ( key.processes.data(), key.hash, create );
+	if ( r.second )
+		w.fresh.push_back ( r.first );
+
+	return * r.first;
+}
+
+void ParallelExplorer::add_edge ( const CFGEdge & e )
+{
+	Worker & w = *_current;
+	if ( !w.pending_edges.empty() && w.pending_edges.front().from != e.from )
+		throw logic_error ( "All pending edges must start in the same state" );
+
+	w.pending_edges.push_back ( e );
+}
+
+void ParallelExplorer::commit_edges ( Worker & w )
+{
+	if ( w.pending_edges.empty() )
+		return;
+
+	ControlState * from = w.pending_edges.front().from;
+	if ( !from->next.empty() )
+		throw logic_error ( "State already has its edges" );
+
+	CFGEdge * arr = static_cast < CFGEdge * > ( w.edge_arena.allocate (
+			w.pending_edges.size() * sizeof ( CFGEdge ), alignof ( CFGEdge ) ) );
+
+	for ( size_t i = 0; i < w.pending_edges.size(); i++ )
+		new ( & arr[i] ) CFGEdge ( w.pending_edges[i] );
+
+	from->next.edges = arr;
+	from->next.n = w.pending_edges.size();
+	w.n_edges += w.pending_edges.size();
+	w.pending_edges.clear();
+}
+
+void ParallelExplorer::expand ( Worker & w, ControlState & cs )
+{
+	// Visitor explores only New states, as in the sequential search
+	( *w.visitor ) ( CFGEdge ( nullptr, cs, nullptr, 0 ) );
+	commit_edges ( w );
+	cs.st = ControlState::St::Closed;
+
+	// Count new states before this one is finished,
+	// so that _pending can not drop to zero meanwhile.
+	_pending.fetch_add ( w.fresh.size() );
+	{
+		std::lock_guard < std::mutex > guard ( w.lock );
+		for ( ControlState * s : w.fresh )
+			w.queue.push_back ( s );
+	}
+	w.fresh.clear();
+	_pending.fetch_sub ( 1 );
+}
+
+bool ParallelExplorer::next_state ( Worker & w, ControlState * & cs )
+{
+	const unsigned int n = _workers.size();
+	while ( !_abort.load() )
+	{
+		{
+			std::lock_guard < std::mutex > guard ( w.lock );
+			if ( !w.queue.empty() )
+			{
+				cs = w.queue.back();
+				w.queue.pop_back();
+				return true;
+			}
+		}
+
+		if ( _pending.load() == 0 )
+			return false;
+
+		Worker & victim = * _workers [ w.rng() % n ];
+		if ( &victim != &w )
+		{
+			std::lock_guard < std::mutex > guard ( victim.lock );
+			if ( !victim.queue.empty() )
+			{
+				cs = victim.queue.front();
+				victim.queue.pop_front();
+				return true;
+			}
+		}
+
+		std::this_thread::yield();
+	}
+
+	return false;
+}
+
+void ParallelExplorer::run ( Worker & w )
+{
+	_current = & w;
+	try
+	{
+		ControlState * cs;
+		while ( next_state ( w, cs ) )
+			expand ( w, *cs );
+	}
+	catch ( ... )
+	{
+		w.error = std::current_exception();
+		_abort.store ( true );
+	}
+	_current = nullptr;
+}
+
+void ParallelExplorer::explore ( ControlState & initial, const EdgeVisitorGenerator & gen )
+{
+	// Visitors are created here, so that they can share data
+	// computed by the generator.
+	for ( auto & w : _workers )
+		w->visitor = gen ( _g );
+
+	_states.find_or_insert ( initial.processes(), initial.hash, [&initial] () { return & initial; } );
+	_workers[0]->queue.push_back ( & initial );
+	_pending.store ( 1 );
+
+	std::vector < std::thread > threads;
+	for ( size_t i = 1; i < _workers.size(); i++ )
+		threads.emplace_back ( & ParallelExplorer::run, this, std::ref ( *_workers[i] ) );
+
+	run ( *_workers[0] );
+
+	for ( std::thread & t : threads )
+		t.join();
+
+	for ( auto & w : _workers )
+	{
+		delete w->visitor;
+		w->visitor = nullptr;
+	}
+
+	for ( auto & w : _workers )
+	{
+		if ( w->error )
+			std::rethrow_exception ( w->error );
+	}
+}
+
+void ParallelExplorer::release_edges()
+{
+	for ( auto & w : _workers )
+		w->edge_arena.clear();
+}
+
+size_t ParallelExplorer::n_edges() const
+{
+	size_t n = 0;
+	for ( const auto & w : _workers )
+		n += w->n_edges;
+	return n;
+}
+
+size_t ParallelExplorer::memory_usage() const
+{
+	size_t n = _states.memory_usage();
+	for ( const auto & w : _workers )
+		n += w->state_arena.reserved_bytes() + w->edge_arena.reserved_bytes();
+	return n;
+}
+
+} // namespace seq
+} // namespace nts
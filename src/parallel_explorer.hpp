@@ -0,0 +1,99 @@
+#ifndef POR_SRC_PARALLEL_EXPLORER_HPP_
+#define POR_SRC_PARALLEL_EXPLORER_HPP_
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "control_flow_graph.hpp"
+#include "nts-seq.hpp"
+#include "state_table.hpp"
+
+namespace nts {
+namespace seq {
+
+/**
+ * @brief Explores control flow graph using more threads.
+ *
+ * Each worker owns a deque of states to be expanded, its own visitor
+ * and its own arenas. A state is expanded by the worker, which inserted it
+ * to the shared state table. Workers take states from the back
+ * of their own deque and steal from the front of a randomly chosen
+ * deque of another worker, when they have nothing to do.
+ *
+ * The search ends when no state is waiting in a deque
+ * nor being expanded.
+ *
+ * Visitors use the ControlFlowGraph interface as usual. When they
+ * insert states or add edges, the graph forwards these calls here,
+ * to the worker running on the calling thread.
+ */
+class ParallelExplorer
+{
+	private:
+		struct Worker;
+
+		ControlFlowGraph & _g;
+
+		SharedStateTable _states;
+
+		std::vector < std::unique_ptr < Worker > > _workers;
+
+		// Number of states waiting in deques or being expanded
+		std::atomic < std::size_t > _pending;
+
+		// Set when some worker failed
+		std::atomic < bool > _abort;
+
+		// Worker running on current thread
+		static thread_local Worker * _current;
+
+		void run ( Worker & w );
+
+		/**
+		 * @brief Takes a state from own deque, or steals one.
+		 * @returns false iff the search is over
+		 */
+		bool next_state ( Worker & w, ControlState * & cs );
+
+		void expand ( Worker & w, ControlState & cs );
+
+		void commit_edges ( Worker & w );
+
+	public:
+		/**
+		 * @param opts.workers    Number of threads
+		 *        opts.seed       Seed of victim selection
+		 *        opts.huge_pages Use huge pages for arenas
+		 */
+		ParallelExplorer ( ControlFlowGraph & g, const SeqOptions & opts );
+		~ParallelExplorer();
+
+		/**
+		 * @brief Explores all states reachable from 'initial'.
+		 * @pre  Q1: 'initial' is the initial state of the graph
+		 *           and is not inserted yet.
+		 * @post R1: All reachable states have their edges
+		 *           and are Closed.
+		 */
+		void explore ( ControlState & initial, const EdgeVisitorGenerator & gen );
+
+		ControlState * find ( const SuccessorKey & key ) const;
+		ControlState & insert ( const SuccessorKey & key );
+		void add_edge ( const CFGEdge & e );
+
+		// Releases memory of all edge lists
+		void release_edges();
+
+		std::size_t n_states() const { return _states.size(); }
+		std::size_t n_edges() const;
+
+		std::size_t memory_usage() const;
+};
+
+} // namespace seq
+} // namespace nts
+
+#endif // POR_SRC_PARALLEL_EXPLORER_HPP_
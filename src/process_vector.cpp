@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include <libNTS/nts.hpp>
+#include <libNTS/logic.hpp>
+
+#include "process_vector.hpp"
+
+using std::logic_error;
+using std::size_t;
+using std::vector;
+
+namespace nts {
+namespace seq {
+
+namespace
+{
+
+bool uses_thread_id ( const Term & t )
+{
+	switch ( t.term_type() )
+	{
+		case Term::TermType::Leaf:
+			return static_cast < const Leaf & > ( t ).leaf_type() == Leaf::LeafType::ThreadID;
+
+		case Term::TermType::ArithmeticOperation:
+		{
+			auto & ao = static_cast < const ArithmeticOperation & > ( t );
+			return uses_thread_id ( ao.term1() ) || uses_thread_id ( ao.term2() );
+		}
+
+		case Term::TermType::MinusTerm:
+			return uses_thread_id ( static_cast < const MinusTerm & > ( t ).term() );
+
+		case Term::TermType::ArrayTerm:
+		{
+			auto & at = static_cast < const ArrayTerm & > ( t );
+			for ( const Term * i : at.indices() )
+			{
+				if ( uses_thread_id ( *i ) )
+					return true;
+			}
+			return uses_thread_id ( at.array() );
+		}
+	}
+	return true; // unreachable
+}
+
+bool uses_thread_id ( const vector < Term * > & ts )
+{
+	for ( const Term * t : ts )
+	{
+		if ( uses_thread_id ( *t ) )
+			return true;
+	}
+	return false;
+}
+
+bool uses_thread_id ( const Formula & f )
+{
+	switch ( f.type() )
+	{
+		case Formula::Type::FormulaBop:
+		{
+			auto & fb = static_cast < const FormulaBop & > ( f );
+			return uses_thread_id ( fb.formula_1() ) || uses_thread_id ( fb.formula_2() );
+		}
+
+		case Formula::Type::FormulaNot:
+			return uses_thread_id ( static_cast < const FormulaNot & > ( f ).formula() );
+
+		case Formula::Type::QuantifiedFormula:
+			return uses_thread_id ( static_cast < const QuantifiedFormula & > ( f ).formula() );
+
+		case Formula::Type::AtomicProposition:
+			break;
+	}
+
+	auto & ap = static_cast < const AtomicProposition & > ( f );
+	switch ( ap.aptype() )
+	{
+		case AtomicProposition::APType::BooleanTerm:
+			return uses_thread_id ( static_cast < const BooleanTerm & > ( ap ).term() );
+
+		case AtomicProposition::APType::Relation:
+		{
+			auto & r = static_cast < const Relation & > ( ap );
+			return uses_thread_id ( r.term1() ) || uses_thread_id ( r.term2() );
+		}
+
+		case AtomicProposition::APType::Havoc:
+			return false;
+
+		case AtomicProposition::APType::ArrayWrite:
+		{
+			auto & aw = static_cast < const ArrayWrite & > ( ap );
+			return uses_thread_id ( aw.indices_1() ) || uses_thread_id ( aw.indices_2() )
+				|| uses_thread_id ( aw.values() );
+		}
+	}
+	return true; // unreachable
+}
+
+// Some transition of 'bn' may read 'tid'. Calls are assumed to read it.
+bool uses_thread_id ( const BasicNts & bn )
+{
+	for ( const Transition * t : bn.transitions() )
+	{
+		if ( t->rule().kind() != TransitionRule::Kind::Formula )
+			return true;
+
+		auto & ftr = static_cast < const FormulaTransitionRule & > ( t->rule() );
+		if ( uses_thread_id ( ftr.formula() ) )
+			return true;
+	}
+	return false;
+}
+
+} // namespace
+
+//------------------------------------//
+// ProcessVectorLayout                //
+//------------------------------------//
+
+ProcessVectorLayout::ProcessVectorLayout ( const Nts & n, bool symmetric,
+		unsigned int counter_threshold )
+{
+	_symmetric = false;
+	_n_processes = 0;
+	_n_slots = 0;
+	_plain = true;
+	size_t max_count = 0;
+
+	for ( const Instance * i : n.instances() )
+	{
+		const BasicNts & bn = i->basic_nts();
+		for ( State * s : bn.states() )
+		{
+			// One BasicNts may be instantiated more times
+			if ( _ids.find ( s ) != _ids.end() )
+				continue;
+
+			_ids.insert ( std::make_pair ( s, id_t ( _states.size() ) ) );
+			_states.push_back ( s );
+		}
+
+		Block b;
+		b.first    = _n_processes;
+		b.size     = i->n;
+		b.bnts     = & bn;
+		b.slot     = _n_slots;
+		// Threads reading 'tid' are distinguished by it
+		b.symmetric = symmetric && i->n > 1 && !uses_thread_id ( bn );
+		b.counted  = b.symmetric && counter_threshold > 0 && i->n >= counter_threshold
+			&& !bn.states().empty() && bn.states().size() < i->n;
+		b.first_id = bn.states().empty() ? 0 : _ids.at ( bn.states().front() );
+		b.n_slots  = b.counted ? bn.states().size() : i->n;
+
+		if ( b.counted )
+		{
+			_plain = false;
+			if ( i->n > max_count )
+				max_count = i->n;
+		}
+
+		if ( b.symmetric )
+			_symmetric = true;
+
+		_blocks.push_back ( b );
+		for ( unsigned int j = 0; j < i->n; j++ )
+			_block_of.push_back ( _blocks.size() - 1 );
+
+		_n_processes += i->n;
+		_n_slots += b.n_slots;
+	}
+
+	_n_values = std::max ( _states.size(), max_count + 1 );
+
+	if ( _n_values <= 0x100 )
+		_width = 1;
+	else if ( _n_values <= 0x10000 )
+		_width = 2;
+	else
+		_width = 4;
+
+	// Fixed seed, so that runs are reproducible
+	std::mt19937_64 gen ( 0x5eed );
+	_keys.resize ( size_t ( _n_slots ) * _n_values );
+	for ( size_t & k : _keys )
+		k = size_t ( gen() );
+}
+
+ProcessVectorLayout::id_t ProcessVectorLayout::id ( const State * s ) const
+{
+	auto it = _ids.find ( s );
+	if ( it == _ids.end() )
+		throw logic_error ( "State does not belong to any toplevel BasicNts" );
+
+	return it->second;
+}
+
+size_t ProcessVectorLayout::hash ( const unsigned char * packed ) const
+{
+	size_t h = 0;
+	for ( unsigned int i = 0; i < _n_slots; i++ )
+		h ^= key ( i, slot_get ( packed, i ) );
+
+	return h;
+}
+
+ProcessVectorLayout::id_t ProcessVectorLayout::get_counted (
+		const Block & b, const unsigned char * packed, unsigned int pid ) const
+{
+	// Find the counter, which covers pid-th process of sorted block
+	unsigned int rank = pid - b.first;
+	for ( unsigned int i = 0; i < b.n_slots; i++ )
+	{
+		unsigned int c = slot_get ( packed, b.slot + i );
+		if ( rank < c )
+			return b.first_id + i;
+		rank -= c;
+	}
+
+	throw logic_error ( "Counters of block do not sum up to its size" );
+}
+
+unsigned int ProcessVectorLayout::run_length ( const unsigned char * packed, unsigned int pid ) const
+{
+	if ( _plain )
+		return 1;
+
+	const Block & b = block_of ( pid );
+	if ( !b.counted )
+		return 1;
+
+	unsigned int rank = pid - b.first;
+	for ( unsigned int i = 0; i < b.n_slots; i++ )
+	{
+		unsigned int c = slot_get ( packed, b.slot + i );
+		if ( rank < c )
+			return c - rank;
+		rank -= c;
+	}
+
+	throw logic_error ( "Counters of block do not sum up to its size" );
+}
+
+unsigned int ProcessVectorLayout::move ( unsigned char * packed, size_t & h,
+		unsigned int pid, id_t id ) const
+{
+	if ( _plain && !_symmetric )
+	{
+		slot_set ( packed, h, pid, id );
+		return pid;
+	}
+
+	const Block & b = block_of ( pid );
+	if ( b.counted )
+		return move_counted ( b, packed, h, pid, id );
+
+	if ( b.symmetric )
+		return move_sorted ( b, packed, h, pid, id );
+
+	slot_set ( packed, h, b.slot + ( pid - b.first ), id );
+	return pid;
+}
+
+unsigned int ProcessVectorLayout::move_sorted ( const Block & b, unsigned char * packed,
+		size_t & h, unsigned int pid, id_t id ) const
+{
+	// Positions inside the block
+	const unsigned int last = b.size - 1;
+	unsigned int pos = pid - b.first;
+
+	// Move up while the next process has smaller local state
+	while ( pos < last && slot_get ( packed, b.slot + pos + 1 ) < id )
+	{
+		slot_set ( packed, h, b.slot + pos, slot_get ( packed, b.slot + pos + 1 ) );
+		pos++;
+	}
+
+	// Move down while the previous process has greater local state
+	while ( pos > 0 && slot_get ( packed, b.slot + pos - 1 ) > id )
+	{
+		slot_set ( packed, h, b.slot + pos, slot_get ( packed, b.slot + pos - 1 ) );
+		pos--;
+	}
+
+	slot_set ( packed, h, b.slot + pos, id );
+	return b.first + pos;
+}
+
+unsigned int ProcessVectorLayout::move_counted ( const Block & b, unsigned char * packed,
+		size_t & h, unsigned int pid, id_t id ) const
+{
+	const id_t from = get_counted ( b, packed, pid );
+	if ( from == id )
+		return pid;
+
+	const unsigned int s_from = b.slot + ( from - b.first_id );
+	const unsigned int s_to   = b.slot + ( id   - b.first_id );
+	slot_set ( packed, h, s_from, slot_get ( packed, s_from ) - 1 );
+	slot_set ( packed, h, s_to,   slot_get ( packed, s_to ) + 1 );
+
+	// Same position, as the sorted block would give:
+	// first of its new run when moving up, last of it when moving down.
+	unsigned int pos = 0;
+	for ( unsigned int s = b.slot; s < s_to; s++ )
+		pos += slot_get ( packed, s );
+
+	if ( id < from )
+		pos += slot_get ( packed, s_to ) - 1;
+
+	return b.first + pos;
+}
+
+double ProcessVectorLayout::orbit_size ( const unsigned char * packed ) const
+{
+	// Multinomial coefficient n! / ( k_1! * ... * k_m! ) for each block,
+	// computed incrementally as a product of binomials.
+	double result = 1;
+	for ( const Block & b : _blocks )
+	{
+		if ( b.counted )
+		{
+			unsigned int total = 0;
+			for ( unsigned int i = 0; i < b.n_slots; i++ )
+			{
+				unsigned int c = slot_get ( packed, b.slot + i );
+				for ( unsigned int run = 1; run <= c; run++ )
+					result = result * ( ++total ) / run;
+			}
+			continue;
+		}
+
+		if ( !b.symmetric )
+			continue;
+
+		unsigned int run = 0;
+		for ( unsigned int i = 0; i < b.size; i++ )
+		{
+			if ( i > 0 && get ( packed, b.first + i ) == get ( packed, b.first + i - 1 ) )
+				run++;
+			else
+				run = 1;
+
+			// multiply by C(i+1, run) / C(i, run-1) == (i+1) / run
+			result = result * ( i + 1 ) / run;
+		}
+	}
+	return result;
+}
+
+void ProcessVectorLayout::initial ( const Nts & n, unsigned char * packed ) const
+{
+	unsigned int pid = 0;
+	for ( const Instance * i : n.instances() )
+	{
+		const BasicNts & bn = i->basic_nts();
+		State * initial_state = nullptr;
+
+		for ( State * s : bn.states() )
+		{
+			if ( s->is_initial() )
+			{
+				if ( initial_state )
+					throw logic_error ( "Only one initial state is supported" );
+				initial_state = s;
+			}
+		}
+
+		if ( !initial_state )
+			throw logic_error ( "BasicNts " + bn.name + " has no initial state" );
+
+		id_t initial_id = id ( initial_state );
+		const Block & b = block_of ( pid );
+		if ( b.counted )
+		{
+			for ( unsigned int j = 0; j < b.n_slots; j++ )
+				slot_set ( packed, b.slot + j, 0 );
+			slot_set ( packed, b.slot + ( initial_id - b.first_id ), i->n );
+		}
+		else
+		{
+			for ( unsigned int j = 0; j < i->n; j++ )
+				slot_set ( packed, b.slot + j, initial_id );
+		}
+		pid += i->n;
+	}
+}
+
+} // namespace seq
+} // namespace nts
@@ -0,0 +1,257 @@
+#ifndef POR_SRC_PROCESS_VECTOR_HPP_
+#define POR_SRC_PROCESS_VECTOR_HPP_
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <libNTS/nts.hpp>
+
+namespace nts {
+namespace seq {
+
+/**
+ * @brief Dense numbering of local states and layout of packed process vectors.
+ *
+ * Every state of every toplevel BasicNts gets a small integer id.
+ * A process vector (one local state per process) is then stored
+ * as a fixed-width array of slots. Width of one slot (1, 2 or 4 bytes)
+ * is chosen according to the largest value, which has to be stored.
+ *
+ * Hash of a process vector is a xor of per-(slot, value)
+ * random keys (Zobrist hashing), so when a single process moves,
+ * the new hash can be derived from the old one in constant time.
+ *
+ * Processes of one Instance form a block. Processes inside a block
+ * run the same BasicNts, so they are interchangeable, unless the BasicNts
+ * reads 'tid'. In symmetric mode, process vectors are kept canonical:
+ * ids are sorted inside each symmetric block.
+ *
+ * Big blocks may be stored as counters instead (counter abstraction).
+ * Such a block has one slot per local state of its BasicNts,
+ * holding the number of processes in that state. Process 'pid'
+ * of a counted block is then the pid-th process of the sorted block,
+ * so counted and sorted blocks describe the same states.
+ *
+ * invariant: I1: ids are assigned in range [0, n_local_states() )
+ *            I2: state ( id ( s ) ) == s
+ *            I3: ids of states of one BasicNts form a contiguous range
+ */
+class ProcessVectorLayout
+{
+	public:
+		using id_t = std::uint32_t;
+
+		// Processes [first, first + size) are instances of the same BasicNts
+		struct Block
+		{
+			unsigned int first;
+			unsigned int size;
+			const nts::BasicNts * bnts;
+
+			// Block is stored in slots [slot, slot + n_slots)
+			unsigned int slot;
+			unsigned int n_slots;
+
+			// Kept sorted, i.e. processes are interchangeable
+			bool symmetric;
+
+			// Stored as counters of local states [first_id, first_id + n_slots)
+			bool counted;
+			id_t first_id;
+		};
+
+	private:
+		std::vector < nts::State * > _states;
+		std::unordered_map < const nts::State *, id_t > _ids;
+
+		unsigned int _n_processes;
+		unsigned int _n_slots;
+		unsigned int _width;
+
+		// Some block is symmetric
+		bool _symmetric;
+
+		// No block is counted, so slot of process 'pid' is 'pid'
+		bool _plain;
+
+		// Number of values a slot can hold
+		std::size_t _n_values;
+
+		// Zobrist keys, indexed by slot * _n_values + value
+		std::vector < std::size_t > _keys;
+
+		std::vector < Block > _blocks;
+		std::vector < unsigned int > _block_of; //< indexed by pid
+
+		id_t slot_get ( const unsigned char * packed, unsigned int slot ) const
+		{
+			switch ( _width )
+			{
+				case 1:
+					return packed[slot];
+
+				case 2:
+				{
+					std::uint16_t v;
+					std::memcpy ( &v, packed + 2 * slot, 2 );
+					return v;
+				}
+
+				default:
+				{
+					std::uint32_t v;
+					std::memcpy ( &v, packed + 4 * slot, 4 );
+					return v;
+				}
+			}
+		}
+
+		void slot_set ( unsigned char * packed, unsigned int slot, id_t v ) const
+		{
+			switch ( _width )
+			{
+				case 1:
+					packed[slot] = static_cast < unsigned char > ( v );
+					break;
+
+				case 2:
+				{
+					std::uint16_t w = static_cast < std::uint16_t > ( v );
+					std::memcpy ( packed + 2 * slot, &w, 2 );
+					break;
+				}
+
+				default:
+					std::memcpy ( packed + 4 * slot, &v, 4 );
+					break;
+			}
+		}
+
+		std::size_t key ( unsigned int slot, id_t v ) const
+		{
+			return _keys [ slot * _n_values + v ];
+		}
+
+		/**
+		 * @brief Sets value of given slot and updates the hash accordingly.
+		 * @pre  h == hash ( packed )
+		 * @post h == hash ( packed )
+		 */
+		void slot_set ( unsigned char * packed, std::size_t & h, unsigned int slot, id_t v ) const
+		{
+			h ^= key ( slot, slot_get ( packed, slot ) ) ^ key ( slot, v );
+			slot_set ( packed, slot, v );
+		}
+
+		id_t get_counted ( const Block & b, const unsigned char * packed, unsigned int pid ) const;
+
+		unsigned int move_sorted  ( const Block & b, unsigned char * packed, std::size_t & h,
+				unsigned int pid, id_t id ) const;
+		unsigned int move_counted ( const Block & b, unsigned char * packed, std::size_t & h,
+				unsigned int pid, id_t id ) const;
+
+	public:
+
+		/**
+		 * @param symmetric          Keep blocks canonical, except blocks
+		 *                           whose BasicNts reads 'tid'
+		 * @param counter_threshold  In symmetric mode, symmetric blocks with at
+		 *                           least this many processes are counted.
+		 *                           Zero means no block is counted.
+		 * @pre  Q1: Each BasicNts instantiated in n has exactly one initial state.
+		 */
+		explicit ProcessVectorLayout ( const nts::Nts & n, bool symmetric = false,
+				unsigned int counter_threshold = 0 );
+
+		ProcessVectorLayout ( const ProcessVectorLayout & ) = delete;
+
+		unsigned int n_processes() const { return _n_processes; }
+		std::size_t  n_local_states() const { return _states.size(); }
+		bool         symmetric() const { return _symmetric; }
+
+		// Size of one packed process vector in bytes
+		std::size_t  stride() const { return _n_slots * _width; }
+
+		const std::vector < Block > & blocks() const { return _blocks; }
+		const Block & block_of ( unsigned int pid ) const { return _blocks[ _block_of[pid] ]; }
+
+		/**
+		 * @pre Given state must belong to some toplevel BasicNts.
+		 */
+		id_t id ( const nts::State * s ) const;
+
+		nts::State * state ( id_t id ) const { return _states[id]; }
+
+		// Local state of process 'pid'
+		nts::State * state ( const unsigned char * packed, unsigned int pid ) const
+		{
+			return _states[ get ( packed, pid ) ];
+		}
+
+		// Id of local state of process 'pid'
+		id_t get ( const unsigned char * packed, unsigned int pid ) const
+		{
+			if ( _plain )
+				return slot_get ( packed, pid );
+
+			const Block & b = block_of ( pid );
+			if ( b.counted )
+				return get_counted ( b, packed, pid );
+
+			return slot_get ( packed, b.slot + ( pid - b.first ) );
+		}
+
+		/**
+		 * @brief Number of processes pid, pid + 1, ... of a counted block,
+		 *        which are in the same local state.
+		 *
+		 * Their successors differ only by which of them moved,
+		 * so the successor states can be computed once for all of them.
+		 * @returns 1 for processes outside counted blocks
+		 */
+		unsigned int run_length ( const unsigned char * packed, unsigned int pid ) const;
+
+		bool equal ( const unsigned char * a, const unsigned char * b ) const
+		{
+			return 0 == std::memcmp ( a, b, stride() );
+		}
+
+		std::size_t hash ( const unsigned char * packed ) const;
+
+		/**
+		 * @brief Moves process 'pid' to local state 'id'.
+		 *
+		 * If the block of 'pid' is symmetric, it is kept canonical:
+		 * the moved process is placed among other processes
+		 * in the same local state, and processes between its old
+		 * and new position shift by one towards the old position.
+		 *
+		 * @pre  Q1: packed is canonical (in symmetric mode)
+		 *       Q2: h == hash ( packed )
+		 * @post R1: packed is canonical (in symmetric mode)
+		 *       R2: h == hash ( packed )
+		 * @returns new position of the moved process
+		 *          (always 'pid' if the block is not symmetric)
+		 */
+		unsigned int move ( unsigned char * packed, std::size_t & h, unsigned int pid, id_t id ) const;
+
+		/**
+		 * @brief Number of process vectors, which are equal
+		 *        to given canonical vector up to permutation inside blocks.
+		 */
+		double orbit_size ( const unsigned char * packed ) const;
+
+		/**
+		 * @brief Writes process vector of initial control state to given buffer.
+		 */
+		void initial ( const nts::Nts & n, unsigned char * packed ) const;
+};
+
+} // namespace seq
+} // namespace nts
+
+#endif // POR_SRC_PROCESS_VECTOR_HPP_
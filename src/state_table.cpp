@@ -0,0 +1,289 @@
+#include <cstdlib>         // std::calloc, std::free
+#include <new>             // std::bad_alloc
+#include <stdexcept>
+#include <utility>
+
+#include "control_flow_graph.hpp"
+#include "state_table.hpp"
+
+using std::logic_error;
+using std::size_t;
+
+namespace nts {
+namespace seq {
+
+namespace
+{
+
+// Slots of the old array moved by one insertion
+const size_t migration_step = 64;
+
+// Marker of a slot, which was moved to the new array
+ControlState * const moved_marker = reinterpret_cast < ControlState * > ( 1 );
+
+} // namespace
+
+//------------------------------------//
+// StateTable::Array                  //
+//------------------------------------//
+
+void StateTable::FreeSlots::operator() ( Slot * slots ) const
+{
+	std::free ( slots );
+}
+
+void StateTable::Array::allocate ( size_t capacity )
+{
+	// Empty slot is all zero bytes. Large blocks are mapped
+	// from the kernel already zeroed, so calloc does not touch them
+	// and grow() does not pause for clearing the doubled array;
+	// pages are faulted in as the migration and insertions reach them.
+	Slot * s = static_cast < Slot * > ( std::calloc ( capacity, sizeof ( Slot ) ) );
+	if ( !s )
+		throw std::bad_alloc();
+
+	slots.reset ( s );
+	mask = capacity - 1;
+}
+
+void StateTable::Array::release()
+{
+	slots.reset();
+	mask = 0;
+}
+
+//------------------------------------//
+// StateTable                         //
+//------------------------------------//
+
+StateTable::StateTable ( const ProcessVectorLayout & layout, size_t initial_capacity ) :
+	_layout ( layout )
+{
+	size_t capacity = 16;
+	while ( capacity < initial_capacity )
+		capacity *= 2;
+
+	_table.allocate ( capacity );
+	_migrated = 0;
+	_size = 0;
+}
+
+ControlState * StateTable::moved()
+{
+	return moved_marker;
+}
+
+size_t StateTable::slot_index ( size_t hash, size_t mask )
+{
+	// Finalizer of MurmurHash3, spreads entropy to lower bits
+	unsigned long long h = hash;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return size_t ( h ) & mask;
+}
+
+ControlState * StateTable::find_in ( const Array & a, const unsigned char * packed, size_t hash ) const
+{
+	for ( size_t i = slot_index ( hash, a.mask ); ; i = ( i + 1 ) & a.mask )
+	{
+		const Slot & s = a.slots[i];
+		if ( !s.cs )
+			return nullptr;
+
+		if ( s.cs != moved() && s.hash == hash && _layout.equal ( s.cs->processes(), packed ) )
+			return s.cs;
+	}
+}
+
+ControlState * StateTable::find ( const unsigned char * packed, size_t hash ) const
+{
+	ControlState * cs = find_in ( _table, packed, hash );
+	if ( !cs && _old.slots )
+		cs = find_in ( _old, packed, hash );
+	return cs;
+}
+
+void StateTable::place ( Array & a, ControlState * cs, size_t hash )
+{
+	size_t i = slot_index ( hash, a.mask );
+	while ( a.slots[i].cs )
+		i = ( i + 1 ) & a.mask;
+
+	a.slots[i].hash = hash;
+	a.slots[i].cs   = cs;
+}
+
+void StateTable::migrate ( size_t n )
+{
+	const size_t cap = _old.capacity();
+	while ( n > 0 && _migrated < cap )
+	{
+		Slot & s = _old.slots[_migrated];
+		if ( s.cs && s.cs != moved() )
+		{
+			place ( _table, s.cs, s.hash );
+			s.cs = moved();
+		}
+		_migrated++;
+		n--;
+	}
+
+	if ( _migrated == cap )
+		_old.release();
+}
+
+void StateTable::grow()
+{
+	// Previous migration must be finished before we start another one
+	if ( _old.slots )
+		migrate ( _old.capacity() );
+
+	_old = std::move ( _table );
+	_table.allocate ( 2 * _old.capacity() );
+	_migrated = 0;
+}
+
+size_t StateTable::probe ( const unsigned char * packed, size_t hash ) const
+{
+	// Single probe through the current array:
+	// either we find an equal state, or the free slot for the new one.
+	size_t i = slot_index ( hash, _table.mask );
+	while ( _table.slots[i].cs )
+	{
+		const Slot & s = _table.slots[i];
+		if ( s.hash == hash && _layout.equal ( s.cs->processes(), packed ) )
+			return i;
+		i = ( i + 1 ) & _table.mask;
+	}
+	return i;
+}
+
+void StateTable::inserted()
+{
+	_size++;
+
+	if ( _old.slots )
+		migrate ( migration_step );
+
+	// Keep load factor under 3/4
+	if ( 4 * _size > 3 * _table.capacity() )
+		grow();
+}
+
+ControlState * StateTable::find_or_insert ( ControlState * cs )
+{
+	if ( cs == nullptr || cs == moved() )
+		throw logic_error ( "Invalid state pointer" );
+
+	return find_or_insert ( cs->processes(), cs->hash, [cs] () { return cs; } ).first;
+}
+
+size_t StateTable::memory_usage() const
+{
+	return ( _table.capacity() + _old.capacity() ) * sizeof ( Slot );
+}
+
+//------------------------------------//
+// StateTable::const_iterator         //
+//------------------------------------//
+
+StateTable::const_iterator::const_iterator ( const StateTable * t, bool in_old, size_t i ) :
+	_t ( t ), _in_old ( in_old ), _i ( i )
+{
+	skip();
+}
+
+void StateTable::const_iterator::skip()
+{
+	while ( true )
+	{
+		const Array & a = _in_old ? _t->_old : _t->_table;
+		if ( _i >= a.capacity() )
+		{
+			if ( _in_old )
+				return; // end
+
+			_in_old = true;
+			_i = 0;
+			continue;
+		}
+
+		ControlState * cs = a.slots[_i].cs;
+		if ( cs && cs != moved() )
+			return;
+
+		_i++;
+	}
+}
+
+ControlState * StateTable::const_iterator::operator* () const
+{
+	const Array & a = _in_old ? _t->_old : _t->_table;
+	return a.slots[_i].cs;
+}
+
+StateTable::const_iterator & StateTable::const_iterator::operator++ ()
+{
+	_i++;
+	skip();
+	return *this;
+}
+
+bool StateTable::const_iterator::operator== ( const const_iterator & other ) const
+{
+	return _t == other._t && _in_old == other._in_old && _i == other._i;
+}
+
+StateTable::const_iterator StateTable::begin() const
+{
+	return const_iterator ( this, false, 0 );
+}
+
+StateTable::const_iterator StateTable::end() const
+{
+	return const_iterator ( this, true, _old.capacity() );
+}
+
+//------------------------------------//
+// SharedStateTable                   //
+//------------------------------------//
+
+SharedStateTable::SharedStateTable ( const ProcessVectorLayout & layout, unsigned int n_shards )
+{
+	unsigned int bits = 0;
+	while ( ( 1u << bits ) < n_shards )
+		bits++;
+
+	_shift = sizeof ( size_t ) * 8 - bits;
+	for ( unsigned int i = 0; i < ( 1u << bits ); i++ )
+		_shards.emplace_back ( new Shard ( layout ) );
+}
+
+ControlState * SharedStateTable::find ( const unsigned char * packed, size_t hash ) const
+{
+	Shard & s = shard ( hash );
+	std::lock_guard < std::mutex > guard ( s.lock );
+	return s.table.find ( packed, hash );
+}
+
+size_t SharedStateTable::size() const
+{
+	size_t n = 0;
+	for ( const auto & s : _shards )
+		n += s->table.size();
+	return n;
+}
+
+size_t SharedStateTable::memory_usage() const
+{
+	size_t n = 0;
+	for ( const auto & s : _shards )
+		n += s->table.memory_usage();
+	return n;
+}
+
+} // namespace seq
+} // namespace nts
@@ -0,0 +1,230 @@
+#ifndef POR_SRC_STATE_TABLE_HPP_
+#define POR_SRC_STATE_TABLE_HPP_
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <memory>         // std::unique_ptr
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "process_vector.hpp"
+
+namespace nts {
+namespace seq {
+
+struct ControlState;
+
+/**
+ * @brief Set of control states, keyed by their packed process vectors.
+ *
+ * Open addressing with linear probing. Each slot stores the hash
+ * of its state, so most of unsuccessful comparisons do not touch
+ * the process vector at all.
+ *
+ * When the table grows, the old array is not rehashed at once.
+ * Instead, every insertion moves a few slots of the old array
+ * to the new one, and lookups search both arrays until the old one
+ * is empty. Moved slots are marked by a tombstone, so that probe
+ * sequences in the old array stay unbroken.
+ *
+ * The table does not own the states.
+ */
+class StateTable
+{
+	private:
+		struct Slot
+		{
+			std::size_t hash;
+			ControlState * cs; //< nullptr means empty slot
+		};
+
+		// Slot arrays come from calloc, see Array::allocate
+		struct FreeSlots
+		{
+			void operator() ( Slot * slots ) const;
+		};
+
+		struct Array
+		{
+			std::unique_ptr < Slot[], FreeSlots > slots;
+			std::size_t mask; //< capacity - 1, capacity is power of two
+
+			std::size_t capacity() const { return slots ? mask + 1 : 0; }
+			void allocate ( std::size_t capacity );
+			void release();
+		};
+
+		const ProcessVectorLayout & _layout;
+
+		Array _table;
+
+		// Array being migrated to _table. Empty if no migration is in progress.
+		Array _old;
+		std::size_t _migrated; //< slots of _old with index < _migrated are moved
+
+		std::size_t _size;
+
+		static ControlState * moved();
+		static std::size_t slot_index ( std::size_t hash, std::size_t mask );
+
+		ControlState * find_in ( const Array & a, const unsigned char * packed, std::size_t hash ) const;
+
+		// Moves up to 'n' slots from _old to _table
+		void migrate ( std::size_t n );
+
+		void grow();
+
+		// Inserts state, which is known not to be in the table.
+		void place ( Array & a, ControlState * cs, std::size_t hash );
+
+		// Returns index of either equal state or free slot in _table
+		std::size_t probe ( const unsigned char * packed, std::size_t hash ) const;
+
+		// Bookkeeping after a slot of _table was filled
+		void inserted();
+
+	public:
+		explicit StateTable ( const ProcessVectorLayout & layout, std::size_t initial_capacity = 1024 );
+		StateTable ( const StateTable & ) = delete;
+
+		/**
+		 * @param hash must be layout.hash ( packed )
+		 * @returns state with given process vector, or nullptr
+		 */
+		ControlState * find ( const unsigned char * packed, std::size_t hash ) const;
+
+		/**
+		 * @brief Inserts given state, unless there already is an equal state.
+		 * @pre  cs->hash == layout.hash ( cs->processes )
+		 * @returns The state stored in the table
+		 *          (given cs iff it was inserted).
+		 */
+		ControlState * find_or_insert ( ControlState * cs );
+
+		/**
+		 * @brief Looks up a state with given process vector.
+		 * If there is none, calls 'create' to materialize the state
+		 * and inserts it. The table is probed only once.
+		 *
+		 * @param create  callable returning ControlState * with
+		 *                given process vector and hash
+		 * @returns pair of stored state and flag, whether it was created
+		 */
+		template < typename Create >
+		std::pair < ControlState *, bool > find_or_insert (
+				const unsigned char * packed, std::size_t hash, Create create );
+
+		std::size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+
+		// Number of bytes used by slot arrays
+		std::size_t memory_usage() const;
+
+		class const_iterator : public std::iterator < std::forward_iterator_tag, ControlState * >
+		{
+			private:
+				const StateTable * _t;
+				bool _in_old;
+				std::size_t _i;
+
+				void skip();
+
+			public:
+				const_iterator ( const StateTable * t, bool in_old, std::size_t i );
+
+				ControlState * operator* () const;
+				const_iterator & operator++ ();
+				bool operator== ( const const_iterator & other ) const;
+				bool operator!= ( const const_iterator & other ) const { return ! ( *this == other ); }
+		};
+
+		const_iterator begin() const;
+		const_iterator end() const;
+};
+
+template < typename Create >
+std::pair < ControlState *, bool > StateTable::find_or_insert (
+		const unsigned char * packed, std::size_t hash, Create create )
+{
+	if ( _old.slots )
+	{
+		ControlState * found = find_in ( _old, packed, hash );
+		if ( found )
+			return std::make_pair ( found, false );
+	}
+
+	std::size_t i = probe ( packed, hash );
+	if ( _table.slots[i].cs )
+		return std::make_pair ( _table.slots[i].cs, false );
+
+	ControlState * cs = create();
+	_table.slots[i].hash = hash;
+	_table.slots[i].cs   = cs;
+	inserted();
+	return std::make_pair ( cs, true );
+}
+
+/**
+ * @brief StateTable, which can be used by more threads at once.
+ *
+ * States are split to shards by the highest bits of their hashes.
+ * Each shard is an ordinary StateTable guarded by its own mutex,
+ * so threads block each other only when they touch the same shard.
+ */
+class SharedStateTable
+{
+	private:
+		struct Shard
+		{
+			std::mutex lock;
+			StateTable table;
+
+			explicit Shard ( const ProcessVectorLayout & layout ) : table ( layout ) { ; }
+		};
+
+		std::vector < std::unique_ptr < Shard > > _shards;
+		unsigned int _shift;
+
+		Shard & shard ( std::size_t hash ) const
+		{
+			return * _shards [ _shards.size() == 1 ? 0 : hash >> _shift ];
+		}
+
+	public:
+		/**
+		 * @param n_shards will be rounded up to a power of two
+		 */
+		SharedStateTable ( const ProcessVectorLayout & layout, unsigned int n_shards );
+		SharedStateTable ( const SharedStateTable & ) = delete;
+
+		// See StateTable::find
+		ControlState * find ( const unsigned char * packed, std::size_t hash ) const;
+
+		/**
+		 * @brief See StateTable::find_or_insert.
+		 * 'create' is called with the shard locked.
+		 */
+		template < typename Create >
+		std::pair < ControlState *, bool > find_or_insert (
+				const unsigned char * packed, std::size_t hash, Create create );
+
+		// Not synchronized with insertions
+		std::size_t size() const;
+		std::size_t memory_usage() const;
+};
+
+template < typename Create >
+std::pair < ControlState *, bool > SharedStateTable::find_or_insert (
+		const unsigned char * packed, std::size_t hash, Create create )
+{
+	Shard & s = shard ( hash );
+	std::lock_guard < std::mutex > guard ( s.lock );
+	return s.table.find_or_insert ( packed, hash, create );
+}
+
+} // namespace seq
+} // namespace nts
+
+#endif // POR_SRC_STATE_TABLE_HPP_
@@ -3,6 +3,7 @@
 #include <stdexcept>
 #include <sstream>
 #include <algorithm>
+#include <iterator>
 
 #include <libNTS/logic.hpp>
 
@@ -19,6 +20,7 @@ using std::ostream;
 using std::out_of_range;
 using std::runtime_error;
 using std::set;
+using std::size_t;
 using std::sort;
 using std::string;
 using std::stringstream;
@@ -48,29 +50,21 @@ AnnotString * find_annot_origin ( Annotations & ants )
 //------------------------------------//
 
 Task::Task ( string name ) :
-	name ( move ( name ) )
+	name ( move ( name ) ),
+	returns_to_pool ( false ),
+	wakes_pool ( false ),
+	has_number ( false ),
+	number ( 0 )
 {
 	;
 }
 
-void Task::compute_direct_globals()
+void Task::compute_direct_globals ( size_t n_globals )
 {
-	direct_global.reads.clear();
-	direct_global.writes.clear();
+	direct_global = Globals ( n_globals );
 
 	for ( StateInfo * si : states )
-	{
-		for ( Transition * t : si->st->outgoing() )
-		{
-			if ( !t->user_data )
-				throw logic_error ( "Precondition Q2 failed" );
-
-			TransitionInfo * ti = static_cast < TransitionInfo * > ( t->user_data );
-			direct_global.union_with ( ti->global );
-		}
-	}
-
-	cout << "Task " << this->name << " uses:\n" << direct_global;
+		direct_global.union_with ( si->global );
 }
 
 Task::~Task()
@@ -116,18 +110,367 @@ Tasks::~Tasks()
 			delete ti;
 		}
 	}
+
+	for ( const Variable * v : global_variables )
+	{
+		GlobalVariableInfo * gi = static_cast < GlobalVariableInfo * > ( v->user_data );
+		gi->var->user_data = nullptr;
+		delete gi;
+	}
+}
+
+static bool writes_to_pool ( const Globals & g, const Globals & pool )
+{
+	if ( g.writes.everything )
+		return true;
+
+	// Compared by whole arrays, the pool may read cells of other threads
+	BitSet written = g.writes.vars;
+	g.write_regions.arrays ( written );
+	written.union_with ( g.updates );
+	BitSet read = pool.reads;
+	pool.read_regions.arrays ( read );
+	return written.intersects ( read );
+}
+
+void Tasks::classify_global_variables()
+{
+	const size_t n_globals = global_variables.size();
+	auto info = [this] ( size_t i )
+	{
+		return static_cast < GlobalVariableInfo * > ( global_variables[i]->user_data );
+	};
+
+	// Tasks, which run in at most one thread at a time
+	std::map < const BasicNts *, unsigned int > n_threads;
+	for ( const Instance * in : n.instances() )
+		n_threads [ & in->basic_nts() ] += in->n;
+
+	std::map < const Task *, std::set < const BasicNts * > > bnts_of;
+	for ( const BasicNts * bn : toplevel_bnts )
+	{
+		for ( const State * st : bn->states() )
+			bnts_of [ static_cast < StateInfo * > ( st->user_data )->t ].insert ( bn );
+	}
+
+	std::set < const Task * > in_more_threads;
+	for ( const auto & p : bnts_of )
+	{
+		unsigned int threads = 0;
+		for ( const BasicNts * bn : p.second )
+			threads += n_threads [ bn ];
+
+		if ( threads > 1 )
+			in_more_threads.insert ( p.first );
+	}
+
+	Globals pool ( n_globals );
+	for ( StateInfo * si : idle_worker_task->states )
+	{
+		for ( Transition * t : si->st->outgoing() )
+			pool.union_with ( static_cast < TransitionInfo * > ( t->user_data )->global );
+	}
+
+	// Footprints are not stripped yet, so the activation graph
+	// sees every hand-off to the pool.
+	std::set < const Transition * > hand_offs;
+	for ( Task * u : tasks )
+	{
+		u->wakes_pool = false;
+		if ( u == idle_worker_task )
+			continue;
+
+		for ( StateInfo * si : u->states )
+		{
+			for ( Transition * t : si->st->outgoing() )
+			{
+				TransitionInfo * ti = static_cast < TransitionInfo * > ( t->user_data );
+				ti->wakes_pool = writes_to_pool ( ti->global, pool );
+				if ( ti->wakes_pool )
+				{
+					u->wakes_pool = true;
+					hand_offs.insert ( t );
+				}
+			}
+		}
+	}
+
+	// States of main, which may be reached after some thread is created
+	std::set < const StateInfo * > late;
+	std::vector < const StateInfo * > todo;
+	for ( const Transition * t : hand_offs )
+	{
+		if ( static_cast < StateInfo * > ( t->from().user_data )->t == main_task )
+			todo.push_back ( static_cast < StateInfo * > ( t->to().user_data ) );
+	}
+
+	while ( !todo.empty() )
+	{
+		const StateInfo * si = todo.back();
+		todo.pop_back();
+		if ( si->t != main_task || !late.insert ( si ).second )
+			continue;
+
+		for ( Transition * t : si->st->outgoing() )
+			todo.push_back ( static_cast < StateInfo * > ( t->to().user_data ) );
+	}
+
+	// Fill users
+	BitSet late_writes ( n_globals );
+	for ( Task * u : tasks )
+	{
+		for ( StateInfo * si : u->states )
+		{
+			for ( Transition * t : si->st->outgoing() )
+			{
+				const Globals & g = static_cast < TransitionInfo * > ( t->user_data )->global;
+
+				// An update both reads and writes the variable
+				BitSet reads = g.reads;
+				g.read_regions.arrays ( reads );
+				reads.union_with ( g.updates );
+				BitSet writes = g.writes.vars;
+				g.write_regions.arrays ( writes );
+				writes.union_with ( g.updates );
+
+				reads.for_each ( [&info, u] ( size_t i ) { info ( i )->read_users.insert ( u ); } );
+				if ( g.writes.everything )
+				{
+					for ( size_t i = 0; i < n_globals; i++ )
+						info ( i )->write_users.insert ( u );
+				}
+				else
+				{
+					writes.for_each ( [&info, u] ( size_t i ) { info ( i )->write_users.insert ( u ); } );
+				}
+
+				// The hand-off itself runs concurrently with the pool
+				if ( late.count ( si ) || hand_offs.count ( t ) )
+				{
+					if ( g.writes.everything )
+					{
+						for ( size_t i = 0; i < n_globals; i++ )
+							late_writes.set ( i );
+					}
+					late_writes.union_with ( writes );
+				}
+			}
+		}
+	}
+
+	BitSet not_shared ( n_globals );
+	unsigned int n_local = 0;
+	unsigned int n_read_only = 0;
+	for ( size_t i = 0; i < n_globals; i++ )
+	{
+		GlobalVariableInfo * gi = info ( i );
+		std::set < Task * > users = gi->read_users;
+		users.insert ( gi->write_users.begin(), gi->write_users.end() );
+
+		// Idle threads run from the start, so the pool may read
+		// a variable while main initializes it
+		const bool init_only = main_task && !in_more_threads.count ( main_task )
+			&& gi->write_users.size() == 1 && *gi->write_users.begin() == main_task
+			&& !late_writes.test ( i )
+			&& !gi->read_users.count ( idle_worker_task );
+
+		if ( gi->write_users.empty() || init_only )
+		{
+			gi->sharing = GlobalVariableInfo::Sharing::ReadOnly;
+			n_read_only++;
+		}
+		else if ( users.size() == 1 && !in_more_threads.count ( *users.begin() ) )
+		{
+			gi->sharing = GlobalVariableInfo::Sharing::ThreadLocal;
+			n_local++;
+		}
+		else
+		{
+			gi->sharing = GlobalVariableInfo::Sharing::Shared;
+			continue;
+		}
+
+		not_shared.set ( i );
+	}
+
+	for ( const BasicNts * bn : toplevel_bnts )
+	{
+		for ( Transition * t : bn->transitions() )
+		{
+			Globals & g = static_cast < TransitionInfo * > ( t->user_data )->global;
+			g.reads.subtract ( not_shared );
+			g.writes.vars.subtract ( not_shared );
+			g.read_regions.erase ( not_shared );
+			g.write_regions.erase ( not_shared );
+			g.updates.subtract ( not_shared );
+		}
+	}
+
+	cout << "Global variables: " << n_local << " thread-local, "
+		 << n_read_only << " read-only, "
+		 << n_globals - n_local - n_read_only << " shared\n";
+}
+
+void Tasks::compute_activation_graph()
+{
+	for ( Task * u : tasks )
+	{
+		u->activates.clear();
+		u->returns_to_pool = false;
+
+		for ( StateInfo * si : u->states )
+		{
+			for ( Transition * t : si->st->outgoing() )
+			{
+				Task * v = static_cast < StateInfo * > ( t->to().user_data )->t;
+				if ( v == u )
+					continue;
+
+				if ( v == idle_worker_task )
+					u->returns_to_pool = true;
+				else
+					u->activates.insert ( v );
+			}
+		}
+
+		// Writes to the pool may wake up an idle thread
+		if ( u->wakes_pool )
+			u->activates.insert ( idle_worker_task );
+
+		cout << "Task " << u->name << " may activate: ";
+		for ( const Task * v : u->activates )
+			cout << v->name << " ";
+		if ( u->returns_to_pool )
+			cout << "(returns to pool)";
+		cout << "\n";
+	}
 }
 
 void Tasks::compute_transitive_globals()
 {
-	Globals all_gs;
 	for ( Task * t : tasks )
-		all_gs.union_with ( t->direct_global );
+		t->transitive_global = t->direct_global;
 
-	for ( Task * t : tasks )
-		t->transitive_global = all_gs;
+	bool changed = true;
+	while ( changed )
+	{
+		changed = false;
+		for ( Task * u : tasks )
+		{
+			Globals g = u->transitive_global;
+			for ( const Task * v : u->activates )
+				g.union_with ( v->transitive_global );
+
+			if ( u->returns_to_pool )
+				g.union_with ( idle_worker_task->direct_global );
+
+			if ( g != u->transitive_global )
+			{
+				u->transitive_global = move ( g );
+				changed = true;
+			}
+		}
+	}
+}
 
-};
+void Tasks::compute_future_globals()
+{
+	const Globals & pool = idle_worker_task->direct_global;
+
+	for ( Task * u : tasks )
+	{
+		for ( StateInfo * si : u->states )
+		{
+			si->future_global = si->global;
+			for ( Transition * t : si->st->outgoing() )
+			{
+				Task * v = static_cast < StateInfo * > ( t->to().user_data )->t;
+				if ( v == idle_worker_task && u != idle_worker_task )
+					si->future_global.union_with ( pool );
+				else if ( v != u )
+					si->future_global.union_with ( v->transitive_global );
+
+				TransitionInfo * ti = static_cast < TransitionInfo * > ( t->user_data );
+				if ( ti->wakes_pool )
+					si->future_global.union_with ( idle_worker_task->transitive_global );
+			}
+		}
+	}
+
+	bool changed = true;
+	while ( changed )
+	{
+		changed = false;
+		for ( Task * u : tasks )
+		{
+			// Backward propagation converges faster in reverse order
+			for ( auto it = u->states.rbegin(); it != u->states.rend(); ++it )
+			{
+				StateInfo * si = *it;
+				Globals g = si->future_global;
+				for ( Transition * t : si->st->outgoing() )
+				{
+					StateInfo * to = static_cast < StateInfo * > ( t->to().user_data );
+					if ( to->t == u )
+						g.union_with ( to->future_global );
+				}
+
+				if ( g != si->future_global )
+				{
+					si->future_global = move ( g );
+					changed = true;
+				}
+			}
+		}
+	}
+}
+
+void Tasks::compute_dependency_matrix()
+{
+	for ( unsigned int i = 0; i < tasks.size(); i++ )
+	{
+		tasks[i]->number = i;
+		tasks[i]->has_number = true;
+	}
+
+	// Few distinct footprints are expected, linear search is enough
+	future_classes.clear();
+	for ( Task * task : tasks )
+	{
+		for ( StateInfo * si : task->states )
+		{
+			unsigned int c = 0;
+			while ( c < future_classes.size() && future_classes[c] != si->future_global )
+				c++;
+
+			if ( c == future_classes.size() )
+				future_classes.push_back ( si->future_global );
+
+			si->future_class = c;
+		}
+	}
+
+	const size_t n_classes = future_classes.size();
+	for ( Task * task : tasks )
+	{
+		for ( StateInfo * si : task->states )
+		{
+			si->dependent_futures = BitSet ( n_classes );
+			for ( Transition * t : si->st->outgoing() )
+			{
+				TransitionInfo * ti = static_cast < TransitionInfo * > ( t->user_data );
+				ti->dependent_futures = BitSet ( n_classes );
+				for ( size_t c = 0; c < n_classes; c++ )
+				{
+					if ( future_classes[c].may_collide_with ( ti->global ) )
+						ti->dependent_futures.set ( c );
+				}
+
+				si->dependent_futures.union_with ( ti->dependent_futures );
+			}
+		}
+	}
+}
 
 void Tasks::calculate_toplevel_bnts()
 {
@@ -215,6 +558,18 @@ void Tasks::split_to_tasks ( BasicNts & bn, bool split_by_annot )
 
 void Tasks::compute_transition_info()
 {
+	for ( Variable * v : n.variables() )
+	{
+		if ( v->user_data )
+			throw logic_error ( "Precondition Q2 does not hold" );
+
+		GlobalVariableInfo * gi = new GlobalVariableInfo();
+		gi->var = v;
+		gi->number = global_variables.size();
+		v->user_data = ( void * ) gi;
+		global_variables.push_back ( v );
+	}
+
 	for ( const BasicNts * bn : toplevel_bnts )
 	{
 		for ( Transition * t : bn->transitions() )
@@ -227,6 +582,43 @@ void Tasks::compute_transition_info()
 			t->user_data = ( void * ) ti;
 
 			ti->global = used_global_variables ( n, *t );
+			ti->always_enabled = always_enabled ( t->rule() );
+			ti->local_guard = local_guard ( n, t->rule() );
+		}
+	}
+}
+
+void Tasks::compute_state_info()
+{
+	for ( Task * task : tasks )
+	{
+		for ( StateInfo * si : task->states )
+		{
+			si->global = Globals ( global_variables.size() );
+			si->has_enabled = false;
+			vector < const Formula * > guards;
+			for ( Transition * t : si->st->outgoing() )
+			{
+				TransitionInfo * ti = static_cast < TransitionInfo * > ( t->user_data );
+				si->global.union_with ( ti->global );
+				if ( ti->always_enabled )
+					si->has_enabled = true;
+				else if ( ti->local_guard )
+					guards.push_back ( ti->local_guard );
+			}
+
+			// Typically a branch: 'x < y' and 'x >= y'
+			for ( size_t i = 0; i < guards.size() && !si->has_enabled; i++ )
+			{
+				for ( size_t j = i + 1; j < guards.size(); j++ )
+				{
+					if ( complementary ( *guards[i], *guards[j] ) )
+					{
+						si->has_enabled = true;
+						break;
+					}
+				}
+			}
 		}
 	}
 }
@@ -242,21 +634,7 @@ void Tasks::print_transition_info ( ostream & o ) const
 			o << "\ttransition " << *t << "\n";
 			TransitionInfo * ti = static_cast < TransitionInfo * > ( t->user_data );
 
-			o << "\t\treads: ";
-			for ( const Variable * v : ti->global.reads )
-				o  << v->name << " ";
-
-			if ( ti->global.writes.everything )
-				o << "\n\t\twrites everything\n";
-			else
-			{
-				o << "\n\t\twrites: ";
-				for ( const Variable * v : ti->global.writes.vars )
-				{
-					o << v->name << " ";
-				}
-				o << "\n";
-			}
+			o << PrintGlobals { ti->global, global_variables };
 		}
 	}	
 }
@@ -265,7 +643,9 @@ void Tasks::compute_task_structure()
 {
 	for ( Task *t : tasks )
 	{
-		t->compute_direct_globals();
+		t->compute_direct_globals ( global_variables.size() );
+		cout << "Task " << t->name << " uses:\n"
+			<< PrintGlobals { t->direct_global, global_variables };
 	}
 }
 
@@ -289,32 +669,18 @@ Tasks * Tasks::compute_tasks ( nts::Nts & n, const std::string & main_nts )
 
 	// Assume R1 is true. Now lets calculate R2
 	tasks->compute_transition_info();
+	tasks->classify_global_variables();
 	//tasks->print_transition_info( cout );
+	tasks->compute_state_info();
 	tasks->compute_task_structure();
+	tasks->compute_activation_graph();
 	tasks->compute_transitive_globals();
+	tasks->compute_future_globals();
+	tasks->compute_dependency_matrix();
 
 	return tasks;
 }
 
-//------------------------------------//
-// GlobalReads                        //
-//------------------------------------//
-
-bool GlobalReads::contains ( const Variable * v ) const
-{
-	return cend() != find ( v );
-}
-
-ostream & operator<< ( ostream & o, const GlobalReads & gr )
-{
-	o << "{ ";
-	for ( const Variable * v : gr )
-		o << v->name << ", ";
-	o << "}";
-	return o;
-}
-
-
 //------------------------------------//
 // GlobalWrites                       //
 //------------------------------------//
@@ -333,7 +699,7 @@ void GlobalWrites::union_with ( const GlobalWrites & other )
 	if ( everything )
 		return;
 
-	vars.insert ( other.vars.cbegin(), other.vars.cend() );
+	vars.union_with ( other.vars );
 }
 
 void GlobalWrites::insert_everything()
@@ -342,36 +708,76 @@ void GlobalWrites::insert_everything()
 	everything = true;
 }
 
-bool GlobalWrites::contains ( const Variable * v ) const
+bool GlobalWrites::contains ( unsigned int v ) const
 {
 	if ( everything )
 		return true;
 
-	auto it = vars.find ( v );
-	return it != vars.cend();
+	return vars.test ( v );
 }
 
-void GlobalWrites::insert ( const Variable * v )
+void GlobalWrites::insert ( unsigned int v )
 {
 	if ( everything )
 		return;
 
-	vars.insert ( v );
+	vars.set ( v );
+}
+
+//------------------------------------//
+// ArrayRegions                       //
+//------------------------------------//
+
+void ArrayRegions::insert_cell ( unsigned int array, long index )
+{
+	auto cell = std::make_pair ( array, index );
+	auto it = std::lower_bound ( cells.begin(), cells.end(), cell );
+	if ( it == cells.end() || *it != cell )
+		cells.insert ( it, cell );
+}
+
+void ArrayRegions::union_with ( const ArrayRegions & other )
+{
+	if ( other.cells.empty() )
+		return;
+
+	vector < std::pair < unsigned int, long > > merged;
+	std::set_union ( cells.begin(), cells.end(),
+			other.cells.begin(), other.cells.end(),
+			std::back_inserter ( merged ) );
+	cells = move ( merged );
 }
 
-ostream & operator<< ( ostream & o, const GlobalWrites & gw )
+void ArrayRegions::erase ( const BitSet & arrays )
 {
-	if ( gw.everything )
+	auto in_arrays = [&arrays] ( const std::pair < unsigned int, long > & c )
 	{
-		o << "everything";
-		return o;
+		return c.first < arrays.size() && arrays.test ( c.first );
+	};
+	cells.erase ( std::remove_if ( cells.begin(), cells.end(), in_arrays ), cells.end() );
+}
+
+void ArrayRegions::arrays ( BitSet & out ) const
+{
+	for ( const auto & c : cells )
+		out.set ( c.first );
+}
+
+bool ArrayRegions::overlaps ( const ArrayRegions & other ) const
+{
+	auto i = cells.begin();
+	auto j = other.cells.begin();
+	while ( i != cells.end() && j != other.cells.end() )
+	{
+		if ( *i == *j )
+			return true;
+		if ( *i < *j )
+			++i;
+		else
+			++j;
 	}
 
-	o << "{ ";
-	for ( const Variable * v : gw.vars )
-		o << v->name << ", ";
-	o << "}";
-	return o;
+	return false;
 }
 
 //------------------------------------//
@@ -381,7 +787,41 @@ ostream & operator<< ( ostream & o, const GlobalWrites & gw )
 void Globals::union_with ( const Globals & other )
 {
 	writes.union_with ( other.writes );
-	reads.insert ( other.reads.begin(), other.reads.end() );
+	reads.union_with ( other.reads );
+	read_regions.union_with ( other.read_regions );
+	write_regions.union_with ( other.write_regions );
+	updates.union_with ( other.updates );
+	normalize();
+}
+
+void Globals::normalize()
+{
+	read_regions.erase ( reads );
+	if ( writes.everything )
+		write_regions = ArrayRegions();
+	else
+		write_regions.erase ( writes.vars );
+}
+
+bool Globals::operator== ( const Globals & other ) const
+{
+	return reads == other.reads
+		&& writes.everything == other.writes.everything
+		&& writes.vars == other.writes.vars
+		&& read_regions == other.read_regions
+		&& write_regions == other.write_regions
+		&& updates == other.updates;
+}
+
+// Some array accessed as a whole has also some region
+static bool whole_meets_regions ( const BitSet & whole, const ArrayRegions & r )
+{
+	for ( const auto & c : r.cells )
+	{
+		if ( c.first < whole.size() && whole.test ( c.first ) )
+			return true;
+	}
+	return false;
 }
 
 bool Globals::may_collide_with ( const Globals & other ) const
@@ -389,38 +829,66 @@ bool Globals::may_collide_with ( const Globals & other ) const
 	if ( writes.everything || other.writes.everything )
 		return true;
 
-	for ( const Variable * r : writes.vars )
+	if ( writes.vars.intersects ( other.writes.vars )
+		|| writes.vars.intersects ( other.reads )
+		|| other.writes.vars.intersects ( reads ) )
 	{
-		if ( other.writes.contains ( r ) )
-			return true;
-	
-		if ( other.reads.contains ( r ) )
-			return true;
+		return true;
 	}
 
-	for ( const Variable * r : other.writes.vars )
+	// Updates collide only with other accesses
+	if ( updates.intersects ( other.reads ) || updates.intersects ( other.writes.vars )
+		|| other.updates.intersects ( reads ) || other.updates.intersects ( writes.vars )
+		|| whole_meets_regions ( updates, other.read_regions )
+		|| whole_meets_regions ( updates, other.write_regions )
+		|| whole_meets_regions ( other.updates, read_regions )
+		|| whole_meets_regions ( other.updates, write_regions ) )
 	{
-		if ( writes.contains ( r ) )
-			return true;
+		return true;
+	}
 
-		if ( reads.contains ( r ) )
-			return true;
+	if ( whole_meets_regions ( writes.vars, other.read_regions )
+		|| whole_meets_regions ( writes.vars, other.write_regions )
+		|| whole_meets_regions ( reads, other.write_regions )
+		|| whole_meets_regions ( other.writes.vars, read_regions )
+		|| whole_meets_regions ( other.writes.vars, write_regions )
+		|| whole_meets_regions ( other.reads, write_regions ) )
+	{
+		return true;
 	}
 
-	return false;
+	return write_regions.overlaps ( other.write_regions )
+		|| write_regions.overlaps ( other.read_regions )
+		|| other.write_regions.overlaps ( read_regions );
 }
 
-Globals & Globals::operator= ( const Globals & other )
+static void print_variables ( ostream & o, const BitSet & bs, const ArrayRegions & r,
+		const vector < const Variable * > & vars )
 {
-	this->writes = other.writes;
-	this->reads  = other.reads;
-	return *this;
+	o << "{ ";
+	bs.for_each ( [&o, &vars] ( size_t i ) {
+		o << vars[i]->name << ", ";
+	});
+	for ( const auto & c : r.cells )
+		o << vars[c.first]->name << "[" << c.second << "], ";
+	o << "}";
 }
 
-ostream & operator<< ( ostream & o, const Globals & gs )
+ostream & operator<< ( ostream & o, const PrintGlobals & pg )
 {
-	o << "\treads:  " << gs.reads  << "\n";
-	o << "\twrites: " << gs.writes << "\n";
+	o << "\treads:  ";
+	print_variables ( o, pg.gs.reads, pg.gs.read_regions, pg.vars );
+	o << "\n\twrites: ";
+	if ( pg.gs.writes.everything )
+		o << "everything";
+	else
+		print_variables ( o, pg.gs.writes.vars, pg.gs.write_regions, pg.vars );
+	if ( pg.gs.updates.any() )
+	{
+		o << "\n\tupdates: ";
+		print_variables ( o, pg.gs.updates, ArrayRegions(), pg.vars );
+	}
+	o << "\n";
 	return o;
 }
 
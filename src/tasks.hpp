@@ -2,32 +2,44 @@
 #define POR_TASKS_HPP_
 #pragma once
 
+#include <cstddef>
 #include <functional>
 #include <list>
 #include <map>
 #include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
 #include <set>
 
 #include <libNTS/nts.hpp>
 
+#include "bitset.hpp"
+
 namespace nts {
 namespace seq {
 
 /**
  * @brief Represents set of global variables, which can be modified by something.
  *
- * invariant: I1: If .everything is  true, then .vars.size() == 0.
- *            I2: Each item in .vars points to valid global variable.
+ * Global variables are identified by their numbers,
+ * see GlobalVariableInfo.
+ *
+ * invariant: I1: If .everything is  true, then .vars is empty.
+ *            I2: Each item in .vars is a number of some global variable.
  */
 struct GlobalWrites
 {
-	std::set < const nts::Variable * > vars;
+	BitSet vars;
 	bool everything;
 
 
-	GlobalWrites() : everything ( false ) { ; }
+	explicit GlobalWrites ( std::size_t n_globals = 0 ) :
+		vars ( n_globals ),
+		everything ( false )
+	{
+		;
+	}
 
 	GlobalWrites ( const GlobalWrites & orig ) = default;
 	GlobalWrites ( GlobalWrites && old ) = default;
@@ -41,41 +53,125 @@ struct GlobalWrites
 	/**
 	 * @pre Variable must be global variable.
 	 */
-	bool contains ( const nts::Variable * var ) const;
+	bool contains ( unsigned int var ) const;
 
-	void insert ( const nts::Variable * var );
+	void insert ( unsigned int var );
 	void insert_everything();
 
 	void clear();
 };
 
-std::ostream & operator<< ( std::ostream & o, const GlobalWrites & gw );
-
-struct GlobalReads : public std::set < const nts::Variable * >
+struct GlobalReads : public BitSet
 {
-	bool contains ( const nts::Variable * var ) const;
+	explicit GlobalReads ( std::size_t n_globals = 0 ) :
+		BitSet ( n_globals )
+	{
+		;
+	}
+
+	bool contains ( unsigned int var ) const { return test ( var ); }
+	void insert ( unsigned int var ) { set ( var ); }
 };
 
-std::ostream & operator<< ( std::ostream & o, const GlobalReads & gw );
+/**
+ * @brief Accessed cells of global arrays, given by constant indices.
+ *
+ * Cells indexed by 'tid' are not regions: the generated program
+ * is sequential, so all threads there share the same 'tid'.
+ *
+ * invariant: I1: .cells is sorted and without duplicates
+ */
+struct ArrayRegions
+{
+	std::vector < std::pair < unsigned int, long > > cells;
+
+	bool empty() const { return cells.empty(); }
+
+	void insert_cell ( unsigned int array, long index );
 
+	void union_with ( const ArrayRegions & other );
+
+	// Removes all regions of given arrays
+	void erase ( const BitSet & arrays );
+
+	// Sets bits of all arrays having some region
+	void arrays ( BitSet & out ) const;
+
+	// Commutative
+	bool overlaps ( const ArrayRegions & other ) const;
+
+	bool operator== ( const ArrayRegions & other ) const
+	{
+		return cells == other.cells;
+	}
+};
+
+/**
+ * @brief Global variables used by something.
+ *
+ * Arrays, which are accessed only at constant indices,
+ * are not in .reads and .writes, but in .read_regions and .write_regions.
+ *
+ * Variables, which are only changed by adding a constant (or havoced
+ * without any constraint), are not in .reads and .writes, but in .updates.
+ * Such updates commute with each other.
+ *
+ * invariant: I1: An array in .reads (.writes.vars) has no region
+ *                in .read_regions (.write_regions).
+ *            I2: If .writes.everything, .write_regions is empty.
+ */
 struct Globals
 {
 	GlobalReads  reads;
 	GlobalWrites writes;
 
+	ArrayRegions read_regions;
+	ArrayRegions write_regions;
+
+	BitSet updates;
+
+	explicit Globals ( std::size_t n_globals = 0 ) :
+		reads  ( n_globals ),
+		writes ( n_globals ),
+		updates ( n_globals )
+	{
+		;
+	}
+
 	void union_with ( const Globals & other );
 
+	bool empty() const
+	{
+		return !writes.everything && !writes.vars.any() && !reads.any()
+			&& read_regions.empty() && write_regions.empty() && !updates.any();
+	}
+
+	bool operator== ( const Globals & other ) const;
+	bool operator!= ( const Globals & other ) const { return ! ( *this == other ); }
+
 	/**
 	 * Commutative.
-	 * True iff there exists some global variable, which is
-	 * read or modified by one Globals and modified by second Globals.
+	 * True iff there exists some global variable (or array cell), which is
+	 * read or modified by one Globals and modified by second Globals,
+	 * unless both only update it.
 	 */
 	bool may_collide_with ( const Globals & other ) const;
 
-	Globals & operator= ( const Globals & orig );
+	// Restores invariants I1 and I2
+	void normalize();
+};
+
+/**
+ * @brief Prints sets of global variables by their names.
+ * @param vars Table of global variables, indexed by their numbers
+ */
+struct PrintGlobals
+{
+	const Globals & gs;
+	const std::vector < const nts::Variable * > & vars;
 };
 
-std::ostream & operator<< ( std::ostream & o, const Globals & gs );
+std::ostream & operator<< ( std::ostream & o, const PrintGlobals & pg );
 
 /**
  * @brief Additional information about transition.
@@ -94,6 +190,21 @@ struct TransitionInfo
 {
 	nts::Transition * transition;
 	Globals global;
+
+	// Transition is enabled in every valuation of variables
+	bool always_enabled;
+
+	// Literal over local variables, which enables the transition,
+	// or nullptr (see local_guard)
+	const nts::Formula * local_guard;
+
+	// Writes a variable read by the pool, i.e. may start an idle thread.
+	// Computed before globals are classified.
+	bool wakes_pool;
+
+	// Row of dependency matrix: numbers of future classes,
+	// which may collide with .global
+	BitSet dependent_futures;
 };
 
 struct StateInfo;
@@ -145,6 +256,19 @@ struct Task
 	std::vector < StateInfo * > initial_states;
 	std::vector < StateInfo * > final_states;
 
+	/**
+	 * Tasks, which may run after this one in the same thread,
+	 * or which this one may start in an idle thread
+	 * (see Tasks::compute_activation_graph).
+	 */
+	std::set < Task * > activates;
+
+	// Some transition leads back to the thread pool
+	bool returns_to_pool;
+
+	// Some transition wakes the pool (see TransitionInfo::wakes_pool)
+	bool wakes_pool;
+
 	bool has_number;
 	unsigned int number;
 
@@ -154,12 +278,13 @@ struct Task
 
 	/**
 	 * @pre  Q1: "states_assigned" must be true
-	 *       Q2: Each transition must have associated its TransitionInfo.
-	 *       Q3: Each transition must have computed its globals.
+	 *       Q2: Each state must have computed its StateInfo::global.
 	 *
 	 * @post R1: "direct_globals_computed" is true.
+	 *
+	 * @param n_globals Number of global variables
 	 */
-	void compute_direct_globals();
+	void compute_direct_globals ( std::size_t n_globals );
 };
 
 class Tasks
@@ -179,18 +304,44 @@ class Tasks
 
 		/**
 		 * @pre  Q1: Calculated toplevel_bnts. 
-		 *       Q2: All transitions should have null their user_data.
+		 *       Q2: All transitions and global variables
+		 *           should have null their user_data.
 		 *       Q3 = compute_tasks's R1
 		 *
 		 * @post R1: All Transitions have associated computed TransitionInfo
 		 *           (see compute_tasks's R2 ).
-		 * @assigns Only transitions.
+		 *       R2: All global variables have associated GlobalVariableInfo
+		 *           and are in .global_variables, at index of their number.
+		 * @assigns Transitions, global variables and .global_variables.
 		 */
 		void compute_transition_info();
 
 
 		void print_transition_info ( std::ostream & o ) const;
 
+		/**
+		 * @brief Fills users of global variables and classifies them
+		 *        (see GlobalVariableInfo::Sharing).
+		 *
+		 * Variables, which are not shared, can not make two threads
+		 * dependent, so they are removed from globals of all transitions.
+		 *
+		 * @pre  Q1: Every transition has associated computed TransitionInfo.
+		 *       Q2: Every state has associated StateInfo.
+		 * @post R1: Globals of transitions contain only shared variables.
+		 *       R2: TransitionInfo::wakes_pool and Task::wakes_pool
+		 *           are computed.
+		 */
+		void classify_global_variables();
+
+		/**
+		 * @pre  Q1: Every transition has associated computed TransitionInfo.
+		 *       Q2: Every state has associated StateInfo.
+		 * @post R1: StateInfo::global and StateInfo::has_enabled
+		 *           of every state are computed.
+		 */
+		void compute_state_info();
+
 		/**
 		 * @pre  Q1: Every transition has associated computed TransitionInfo.
 		 *       Q2: Every state has associated computed StateInfo.
@@ -208,12 +359,59 @@ class Tasks
 		 * of indirect global variables, the more times
 		 * it will use some smaller ample set to explore.
 		 *
-		 * In current implementation, this is very trivial:
-		 * We do not assume anything, so each task may activate
-		 * every task (including itself).
+		 * Transitive globals are the least fixpoint of
+		 *   transitive(U) = direct(U)
+		 *                 ∪ transitive(V) for each V in U.activates
+		 *                 ∪ direct(idle_worker_task), if U returns to pool
+		 *
+		 * A thread returning to the pool uses only the pool's own
+		 * variables until somebody starts a new task in it,
+		 * and that somebody accounts for the new task.
+		 *
+		 * @pre Q1: Activation graph is computed.
 		 */
 		void compute_transitive_globals();
 
+		/**
+		 * @brief Computes Task::activates and Task::returns_to_pool.
+		 *
+		 * Task U activates V != U, if some transition leads from U to V,
+		 * unless V is the idle_worker_task. Transitions from
+		 * the idle_worker_task thus activate tasks started by threads
+		 * of the pool. Task U also activates the idle_worker_task,
+		 * if U may write a variable read by the pool (i.e. U creates threads).
+		 *
+		 * @pre  Q1: Direct globals are computed.
+		 *       Q2: Task::wakes_pool is computed.
+		 */
+		void compute_activation_graph();
+
+		/**
+		 * @brief Computes StateInfo::future_global of every state.
+		 *
+		 * This is a backward fixpoint over the transitions of each task:
+		 * future(s) = globals of transitions leaving s
+		 *           ∪ future(s') for each successor s' in the same task
+		 *           ∪ transitive globals of tasks activated from s.
+		 *
+		 * Thus a thread, which has done its last global access,
+		 * does not depend on anything anymore.
+		 *
+		 * @pre  Q1: Transitive globals are computed.
+		 */
+		void compute_future_globals();
+
+		/**
+		 * @brief Numbers tasks, groups states with equal future globals
+		 *        into future classes and computes dependency matrix,
+		 *        i.e. TransitionInfo::dependent_futures
+		 *        and StateInfo::dependent_futures.
+		 * @pre  Q1: Future globals are computed.
+		 * @post R1: Each task has its number, which is its index in .tasks
+		 *       R2: Each state has its StateInfo::future_class
+		 */
+		void compute_dependency_matrix();
+
 		void split_to_tasks();
 
 		void split_to_tasks ( nts::BasicNts & bn, bool split_by_annot );
@@ -223,6 +421,12 @@ class Tasks
 	public:
 		std::vector < Task * > tasks;
 		std::map < std::string, Task * > name_to_task;
+
+		// Global variables indexed by their numbers
+		std::vector < const nts::Variable * > global_variables;
+
+		// Distinct future globals of states, see StateInfo::future_class
+		std::vector < Globals > future_classes;
 		Task * main_task;
 		Task * idle_worker_task;
 
@@ -251,18 +455,49 @@ struct StateInfo
 {
 	nts::State * st;
 	Task * t;
+
+	// Union of globals of outgoing transitions
+	Globals global;
+
+	// In every valuation of variables, some outgoing transition is enabled
+	// and other threads can not disable it: it is always enabled,
+	// or it is one of two transitions with complementary local guards.
+	bool has_enabled;
+
+	// Globals, which may be used by a thread in this state
+	// or by tasks it may activate, from now on
+	Globals future_global;
+
+	// Index of .future_global in Tasks::future_classes
+	unsigned int future_class;
+
+	// Union of dependent_futures of outgoing transitions
+	BitSet dependent_futures;
 };
 
 
 
-// Each variable is associated (through its user pointer)
-// to an instance of this class.
+// Each global variable is associated (through its user pointer)
+// to an instance of this class, as long as Tasks exist.
 struct GlobalVariableInfo
 {
 	nts::Variable * var;
 
+	// Dense number of variable, index to Globals bitsets
+	unsigned int number;
+
+	// Tasks with a transition using the variable (or some of its cells)
 	std::set < Task * > read_users;
 	std::set < Task * > write_users;
+
+	enum class Sharing
+	{
+		ThreadLocal, //< used by one task, which runs in one thread only
+		ReadOnly,    //< written at most by main, before it creates threads
+		Shared
+	};
+
+	Sharing sharing;
 };
 
 
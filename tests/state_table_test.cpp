@@ -0,0 +1,189 @@
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <libNTS/nts.hpp>
+#include "../src/control_flow_graph.hpp"
+#include "../src/process_vector.hpp"
+#include "../src/state_table.hpp"
+
+using std::cerr;
+using std::endl;
+using std::runtime_error;
+using std::set;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+
+using namespace nts;
+using namespace nts::seq;
+
+namespace
+{
+
+const unsigned int n_local_states = 16;
+const unsigned int n_processes    = 4;
+
+void check ( bool cond, const string & what )
+{
+	if ( !cond )
+		throw runtime_error ( what );
+}
+
+/**
+ * @brief Owns control states created by the test.
+ * The table itself does not own them.
+ */
+class States
+{
+	private:
+		const ProcessVectorLayout & _layout;
+		vector < unique_ptr < unsigned char[] > > _memory;
+
+	public:
+		explicit States ( const ProcessVectorLayout & layout ) : _layout ( layout ) { ; }
+
+		// Control state number 'k': local state of process j is j-th digit of k
+		ControlState * create ( unsigned int k )
+		{
+			vector < unsigned char > packed ( _layout.stride(), 0 );
+			size_t h = _layout.hash ( packed.data() );
+			for ( unsigned int pid = 0; pid < n_processes; pid++ )
+			{
+				_layout.move ( packed.data(), h, pid, k % n_local_states );
+				k /= n_local_states;
+			}
+
+			_memory.emplace_back ( new unsigned char [ sizeof ( ControlState ) + _layout.stride() ] );
+			ControlState * cs = new ( _memory.back().get() ) ControlState ( h, _memory.size() - 1 );
+			std::memcpy ( cs->processes(), packed.data(), _layout.stride() );
+			return cs;
+		}
+};
+
+// Slot arrays have power of two sizes; their sum is not a power of two
+// only while an old array is being migrated.
+bool migrating ( const StateTable & t )
+{
+	size_t m = t.memory_usage();
+	return ( m & ( m - 1 ) ) != 0;
+}
+
+// Every stored state must be visited exactly once
+void check_iteration ( const StateTable & t, const vector < ControlState * > & inserted )
+{
+	set < ControlState * > seen;
+	size_t n = 0;
+	for ( ControlState * cs : t )
+	{
+		check ( seen.insert ( cs ).second, "State visited twice" );
+		n++;
+	}
+
+	check ( n == t.size(), "Iteration does not match size()" );
+	check ( seen == set < ControlState * > ( inserted.begin(), inserted.end() ),
+			"Iteration does not visit inserted states" );
+}
+
+void test_growing ( const ProcessVectorLayout & layout )
+{
+	const unsigned int n = 5000;
+
+	States states ( layout );
+	StateTable t ( layout, 16 );
+	vector < ControlState * > inserted;
+	unsigned int checked_during_migration = 0;
+
+	for ( unsigned int k = 0; k < n; k++ )
+	{
+		ControlState * cs = states.create ( k );
+		check ( t.find_or_insert ( cs ) == cs, "New state not inserted" );
+		inserted.push_back ( cs );
+
+		if ( !migrating ( t ) || k % 7 != 0 )
+			continue;
+
+		// Some states are still in the old array, some moved out of it
+		checked_during_migration++;
+		check_iteration ( t, inserted );
+		for ( ControlState * s : inserted )
+			check ( t.find ( s->processes(), s->hash ) == s, "Inserted state not found" );
+
+		// Equal states must be found, not inserted again
+		ControlState * dup = states.create ( k / 2 );
+		check ( t.find_or_insert ( dup ) == inserted [ k / 2 ], "Duplicate inserted" );
+		check ( t.size() == inserted.size(), "Size changed by duplicate" );
+	}
+
+	check ( checked_during_migration > 0, "No migration observed" );
+	check ( t.size() == n, "Wrong size" );
+	check_iteration ( t, inserted );
+
+	for ( unsigned int k = n; k < n + 100; k++ )
+	{
+		ControlState * absent = states.create ( k );
+		check ( t.find ( absent->processes(), absent->hash ) == nullptr, "Absent state found" );
+	}
+}
+
+void test_create_callback ( const ProcessVectorLayout & layout )
+{
+	States states ( layout );
+	StateTable t ( layout, 16 );
+
+	unsigned int created = 0;
+	for ( unsigned int round = 0; round < 2; round++ )
+	{
+		for ( unsigned int k = 0; k < 1000; k++ )
+		{
+			ControlState * key = states.create ( k );
+			auto r = t.find_or_insert ( key->processes(), key->hash,
+					[&] () { created++; return key; } );
+			check ( r.second == ( round == 0 ), "Wrong insertion flag" );
+			check ( t.find ( key->processes(), key->hash ) == r.first, "Stored state not found" );
+		}
+	}
+
+	check ( created == 1000, "Each state must be created once" );
+	check ( t.size() == 1000, "Wrong size" );
+}
+
+} // namespace
+
+int main()
+{
+	Nts n ( "state_table_test" );
+	BasicNts * bn = new BasicNts ( "thread" );
+	bn->insert_to ( n );
+	for ( unsigned int i = 0; i < n_local_states; i++ )
+	{
+		State * s = new State ( "s" + to_string ( i ) );
+		s->insert_to ( *bn );
+	}
+
+	Instance * i = new Instance ( bn, n_processes );
+	i->insert_to ( n );
+
+	ProcessVectorLayout layout ( n );
+
+	try
+	{
+		test_growing ( layout );
+		test_create_callback ( layout );
+	}
+	catch ( const runtime_error & e )
+	{
+		cerr << "Failed: " << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}